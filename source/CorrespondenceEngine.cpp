@@ -0,0 +1,181 @@
+#include "CorrespondenceEngine.h"
+#include "Model.h"
+
+#include <QThread>
+#include <QCoreApplication>
+#include <QThreadPool>
+#include <QRunnable>
+#include <QAtomicInt>
+#include <algorithm>
+
+#include "BatchProcess.h"
+#include "ShapeGraph.h"
+
+CorrespondenceEngine::CorrespondenceEngine(int numWorkers, QAtomicInt * cancelFlag) : numWorkers(numWorkers),
+    numPairs(0), numReverseWins(0), forwardTime(0), reverseTime(0),
+    cancelled(0), cancelFlag(cancelFlag)
+{
+    if(this->numWorkers < 1) this->numWorkers = QThread::idealThreadCount();
+}
+
+QVariantMap CorrespondenceEngine::defaultOptions(int k)
+{
+    QVariantMap options;
+    options["roundtrip"].setValue(true);
+    options["k"].setValue( k );
+    options["isQuietMode"].setValue(true);
+    options["isManyTypesJobs"].setValue(true);
+    return options;
+}
+
+QVariantMap CorrespondenceEngine::matchPair(Model * cachedShapeA, Model * cachedShapeB, QVariantMap options)
+{
+    QString sourceShape = "CACHED_" + cachedShapeA->name();
+    QString targetShape = "CACHED_" + cachedShapeB->name();
+
+    // Each job works on its own copies of the shapes, searches normalize and cut their meshes in place
+    QSharedPointer<Structure::ShapeGraph> shapeA, shapeB;
+    {
+        QMutexLocker locker(&cloneMutex);
+        shapeA = QSharedPointer<Structure::ShapeGraph>(cachedShapeA->cloneAsShapeGraph());
+        shapeB = QSharedPointer<Structure::ShapeGraph>(cachedShapeB->cloneAsShapeGraph());
+    }
+
+    int numJobs = 0;
+
+    QVector< QVector<QVariantMap> > reports;
+
+    // Perform correspondence search
+    {
+        // First pass source to target
+        {
+            auto bp = QSharedPointer<BatchProcess>(new BatchProcess(sourceShape, targetShape, options));
+            bp->cachedShapeA = shapeA;
+            bp->cachedShapeB = shapeB;
+            bp->jobUID = numJobs++;
+            bp->run();
+            reports << bp->jobReports;
+        }
+
+        // Second pass target to source, always searched in full: BatchProcess neither reads a
+        // cost bound nor reports before run() returns, so it cannot be stopped past the forward cost
+        if (options["roundtrip"].toBool())
+        {
+            QSharedPointer<Structure::ShapeGraph> shapeA2, shapeB2;
+            {
+                QMutexLocker locker(&cloneMutex);
+                shapeA2 = QSharedPointer<Structure::ShapeGraph>(cachedShapeB->cloneAsShapeGraph());
+                shapeB2 = QSharedPointer<Structure::ShapeGraph>(cachedShapeA->cloneAsShapeGraph());
+            }
+
+            auto bp2 = QSharedPointer<BatchProcess>(new BatchProcess(targetShape, sourceShape, options));
+            bp2->cachedShapeA = shapeA2;
+            bp2->cachedShapeB = shapeB2;
+            bp2->jobUID = numJobs++;
+            bp2->run();
+            reports << bp2->jobReports;
+        }
+    }
+
+    // Look at reports
+    double minEnergy = 1.0;
+    int totalTime = 0;
+    int passTime[2] = {0, 0};
+    QVariantMap minJob;
+    for (int pass = 0; pass < reports.size(); pass++){
+        for (auto & report : reports[pass]){
+            totalTime += report["search_time"].toInt();
+            passTime[std::min(pass, 1)] += report["search_time"].toInt();
+            double c = report["min_cost"].toDouble();
+            if (c < minEnergy){
+                minEnergy = c;
+                minJob = report;
+            }
+        }
+    }
+
+    if(reports.empty() || reports.front().empty()) return minJob;
+
+    // When best result was from the other way
+    auto firstReport = reports.front().front();
+    if (minJob["job_uid"].toInt() != firstReport["job_uid"].toInt()) minJob["isReversed"].setValue(true);
+
+    minJob["total_search_time"].setValue(totalTime);
+    minJob["reverse_search_time"].setValue(passTime[1]);
+
+    numPairs.fetchAndAddOrdered(1);
+    if (minJob["isReversed"].toBool()) numReverseWins.fetchAndAddOrdered(1);
+    forwardTime.fetchAndAddOrdered(passTime[0]);
+    reverseTime.fetchAndAddOrdered(passTime[1]);
+
+    return minJob;
+}
+
+QString CorrespondenceEngine::statsText()
+{
+    int pairs = numPairs.load(), wins = numReverseWins.load();
+    return QString("Round trip: %1 pairs, reverse pass better for %2 (%3%), forward %4 s, reverse %5 s")
+            .arg(pairs).arg(wins).arg(pairs ? 100.0 * wins / pairs : 0.0, 0, 'f', 1)
+            .arg(forwardTime.load() / 1000.0, 0, 'f', 1).arg(reverseTime.load() / 1000.0, 0, 'f', 1);
+}
+
+void CorrespondenceEngine::cancel()
+{
+    cancelled.store(1);
+}
+
+bool CorrespondenceEngine::isCancelled()
+{
+    return cancelled.load() || (cancelFlag != nullptr && cancelFlag->load());
+}
+
+class PairJobRunnable : public QRunnable
+{
+public:
+    PairJobRunnable(CorrespondenceEngine * engine, CorrespondenceEngine::PairJob * job, int jobIndex,
+                    int numJobs, QAtomicInt & numDone) : engine(engine), job(job), jobIndex(jobIndex),
+                    numJobs(numJobs), numDone(numDone){}
+
+    void run()
+    {
+        if(engine->isCancelled()) return;
+
+        emit(engine->jobStarted(jobIndex));
+
+        // Every job only writes to its own slot, no locking needed to collect results
+        job->result = engine->matchPair(job->sourceModel, job->targetModel, job->options);
+        job->isDone = true;
+
+        int done = numDone.fetchAndAddOrdered(1) + 1;
+
+        emit(engine->jobFinished(jobIndex));
+        emit(engine->progress(done, numJobs));
+    }
+
+    CorrespondenceEngine * engine;
+    CorrespondenceEngine::PairJob * job;
+    int jobIndex, numJobs;
+    QAtomicInt & numDone;
+};
+
+void CorrespondenceEngine::run(QVector<PairJob> & jobs)
+{
+    if(jobs.empty()) return;
+
+    // Workers hold pointers into the jobs array, detach it once up front
+    PairJob * jobsData = jobs.data();
+
+    QAtomicInt numDone(0);
+
+    QThreadPool pool;
+    pool.setMaxThreadCount(numWorkers);
+
+    for(int i = 0; i < jobs.size(); i++)
+        pool.start(new PairJobRunnable(this, &jobsData[i], i, jobs.size(), numDone));
+
+    // Cached models evicted by the workers are deleted later on their own thread, which may
+    // be this one without an event loop, as in the batch tool
+    while(!pool.waitForDone(100))
+        QCoreApplication::sendPostedEvents(nullptr, QEvent::DeferredDelete);
+    QCoreApplication::sendPostedEvents(nullptr, QEvent::DeferredDelete);
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <QObject>
+#include <QVector>
+#include <QVariantMap>
+#include <QMutex>
+#include <QAtomicInt>
+
+class Model;
+
+// Runs shape-to-shape correspondence searches as independent jobs on a pool of workers
+class CorrespondenceEngine : public QObject
+{
+    Q_OBJECT
+public:
+    // Jobs not yet started are skipped once the engine or the external flag is cancelled
+    explicit CorrespondenceEngine(int numWorkers = -1, QAtomicInt * cancelFlag = nullptr);
+
+    struct PairJob{
+        QString source, target;
+        Model * sourceModel;
+        Model * targetModel;
+        QVariantMap options;
+        QVariantMap result;   // filled by the engine, best report of the search
+        bool isDone;          // false if the job was skipped by a cancel
+        PairJob() : sourceModel(nullptr), targetModel(nullptr), isDone(false){}
+    };
+
+    int numWorkers;
+
+    // Runs all jobs concurrently and returns when every job is done or cancelled
+    void run(QVector<PairJob> & jobs);
+
+    // Running searches finish, pending ones are dropped
+    void cancel();
+    bool isCancelled();
+
+    // Search both directions of a single pair and keep the best report
+    QVariantMap matchPair(Model * source, Model * target, QVariantMap options);
+
+    // Default search options used by the dataset analysis
+    static QVariantMap defaultOptions(int k = 4);
+
+    // How often the reverse pass gave the better result, and time spent in each pass,
+    // to judge whether round-trip searches are worth their cost on a dataset
+    QAtomicInt numPairs, numReverseWins;
+    QAtomicInteger<qint64> forwardTime, reverseTime;
+    QString statsText();
+
+signals:
+    void jobStarted(int jobIndex);
+    void jobFinished(int jobIndex);
+    void progress(int numDone, int numJobs);
+
+protected:
+    QAtomicInt cancelled;
+    QAtomicInt * cancelFlag;
+
+    // Cached models are shared by all jobs, cloning them is serialized
+    QMutex cloneMutex;
+};
@@ -0,0 +1,481 @@
+#include "CorrespondenceFile.h"
+#include "CorrespondenceIndex.h"
+
+#include <algorithm>
+#include <tuple>
+#include <cstring>
+
+#include <QFileInfo>
+#include <QDateTime>
+#include <QTextStream>
+#include <QRegExp>
+#include <QHash>
+#include <QSet>
+#include <QSaveFile>
+
+const quint32 CorrespondenceFile::currentVersion;
+
+static const char fileMagic[4] = {'T','B','C','F'};
+static const quint32 fileByteOrder = 0x01020304;
+
+namespace{
+    // Strings are stored once and referenced by id
+    struct StringTable{
+        QHash<QString, quint32> ids;
+        QVector<QByteArray> strings;
+
+        quint32 operator()(const QString & str){
+            auto it = ids.constFind(str);
+            if(it != ids.constEnd()) return it.value();
+            quint32 id = strings.size();
+            ids.insert(str, id);
+            strings.push_back(str.toUtf8());
+            return id;
+        }
+    };
+
+    int compareBytes(const char * a, int alen, const QByteArray & b){
+        int c = std::memcmp(a, b.constData(), std::min(alen, b.size()));
+        if(c != 0) return c;
+        return alen - b.size();
+    }
+}
+
+CorrespondenceFile::CorrespondenceFile() : data(nullptr)
+{
+
+}
+
+CorrespondenceFile::~CorrespondenceFile()
+{
+    close();
+}
+
+bool CorrespondenceFile::write(QString filename, const Matchings & matchings, const CorrespondenceIndex & corr,
+                               const QVector<QStringList> & clusters)
+{
+    StringTable table;
+
+    // Pair-wise matchings and their matching pairs
+    QVector<PairRecord> pairs;
+    QVector<MatchRecord> matches;
+    for (auto s : matchings.keys()){
+        for (auto t : matchings[s].keys()){
+            const QVariantMap & m = matchings[s][t];
+
+            PairRecord r;
+            r.source = table(s);
+            r.target = table(t);
+            r.cost = m["min_cost"].toDouble();
+            r.isReversed = m["isReversed"].toBool() ? 1 : 0;
+            r.firstMatch = matches.size();
+            r.reserved = 0;
+
+            for (auto p : m["matching_pairs"].value<MatchingPairs>()){
+                MatchRecord mr;
+                mr.sourcePart = table(p.first);
+                mr.targetPart = table(p.second);
+                matches << mr;
+            }
+
+            r.numMatches = matches.size() - r.firstMatch;
+            pairs << r;
+        }
+    }
+
+    // Part correspondences
+    QVector<CorrRecord> corrs;
+    {
+        QString s, p, t, q;
+        for (int i = 0; i < corr.size(); i++){
+            corr.record(i, s, p, t, q);
+            CorrRecord r;
+            r.source = table(s);
+            r.sourcePart = table(p);
+            r.target = table(t);
+            r.targetPart = table(q);
+            corrs << r;
+        }
+    }
+
+    // Part clusters, empty ones are skipped so ids stay below the number of items
+    QVector<ClusterRecord> clusterItems;
+    quint32 numClusters = 0;
+    for (int c = 0; c < clusters.size(); c++){
+        int numItems = clusterItems.size();
+        for (auto shapePart : clusters[c]){
+            auto sp = shapePart.split(":");
+            if (sp.size() != 2) continue;
+            ClusterRecord r;
+            r.cluster = numClusters;
+            r.shape = table(sp.front());
+            r.part = table(sp.back());
+            clusterItems << r;
+        }
+        if (clusterItems.size() > numItems) numClusters++;
+    }
+
+    // Records are sorted by id so queries can binary search them
+    std::stable_sort(pairs.begin(), pairs.end(), [](const PairRecord & a, const PairRecord & b){
+        return std::tie(a.source, a.target) < std::tie(b.source, b.target);
+    });
+    std::stable_sort(corrs.begin(), corrs.end(), [](const CorrRecord & a, const CorrRecord & b){
+        return std::tie(a.source, a.sourcePart, a.target) < std::tie(b.source, b.sourcePart, b.target);
+    });
+
+    // String table
+    quint32 numStrings = table.strings.size();
+    QVector<quint32> stringOffsets(numStrings + 1, 0);
+    for (quint32 i = 0; i < numStrings; i++)
+        stringOffsets[i + 1] = stringOffsets[i] + table.strings[i].size();
+
+    QVector<quint32> stringOrder(numStrings);
+    for (quint32 i = 0; i < numStrings; i++) stringOrder[i] = i;
+    std::sort(stringOrder.begin(), stringOrder.end(), [&](quint32 a, quint32 b){
+        return table.strings[a] < table.strings[b];
+    });
+
+    Header h;
+    std::memcpy(h.magic, fileMagic, 4);
+    h.version = currentVersion;
+    h.byteOrder = fileByteOrder;
+    h.numStrings = numStrings;
+    h.stringDataSize = stringOffsets.back();
+    h.numPairs = pairs.size();
+    h.numMatches = matches.size();
+    h.numCorr = corrs.size();
+    h.numClusterItems = clusterItems.size();
+    h.reserved = 0;
+
+    // Written aside and renamed over the old file, which may still be mapped
+    QSaveFile out(filename);
+    if (!out.open(QIODevice::WriteOnly)) return false;
+
+    out.write((const char*)&h, sizeof(Header));
+    out.write((const char*)stringOffsets.constData(), stringOffsets.size() * sizeof(quint32));
+    out.write((const char*)stringOrder.constData(), stringOrder.size() * sizeof(quint32));
+    for (auto & str : table.strings) out.write(str);
+
+    // Records start 8-byte aligned
+    size_t offset = out.pos();
+    out.write(QByteArray(int(alignTo8(offset) - offset), '\0'));
+
+    out.write((const char*)pairs.constData(), pairs.size() * sizeof(PairRecord));
+    out.write((const char*)matches.constData(), matches.size() * sizeof(MatchRecord));
+    out.write((const char*)corrs.constData(), corrs.size() * sizeof(CorrRecord));
+    out.write((const char*)clusterItems.constData(), clusterItems.size() * sizeof(ClusterRecord));
+
+    return out.commit();
+}
+
+bool CorrespondenceFile::convertPairwiseText(QString filename, QString outFile)
+{
+    Matchings matchings;
+    CorrespondenceIndex corr;
+    QVector<QStringList> clusters;
+
+    // Pair-wise distances
+    {
+        QFile file(filename);
+        if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) return false;
+
+        QTextStream in(&file);
+        while (!in.atEnd()){
+            auto item = in.readLine().split(QRegExp("[ \t]"), QString::SkipEmptyParts);
+            if (item.size() != 3) continue;
+            matchings[item[0]][item[1]]["min_cost"] = item[2].toDouble();
+        }
+    }
+
+    // Full dataset matches, stored already oriented from source to target
+    {
+        QFile file(filename + ".match");
+        if (file.open(QIODevice::ReadOnly | QIODevice::Text)){
+            QTextStream in(&file);
+            while (!in.atEnd()){
+                auto l = in.readLine().split(" ", QString::SkipEmptyParts);
+                if (l.size() < 2) continue;
+                auto s = l.at(0);
+                auto t = l.at(1);
+
+                MatchingPairs mp;
+                for (auto txtPair : l.value(2).split("|", QString::SkipEmptyParts)){
+                    auto p = txtPair.split(",", QString::SkipEmptyParts);
+                    if (p.size() != 2) continue;
+                    mp << qMakePair(p.front(), p.back());
+                    corr.add(s, p.front(), t, p.back());
+                    corr.add(t, p.back(), s, p.front());
+                }
+
+                matchings[s][t]["matching_pairs"].setValue(mp);
+            }
+        }
+    }
+
+    clusters = readClusters(filename + ".cluster");
+
+    corr.build();
+
+    return write(outFile, matchings, corr, clusters);
+}
+
+bool CorrespondenceFile::convertDatasetCorrText(QString filename, QString outFile)
+{
+    CorrespondenceIndex corr;
+
+    QFile file(filename);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) return false;
+
+    QTextStream in(&file);
+    while (!in.atEnd()){
+        auto item = in.readLine().split(QRegExp("[ \t]"), QString::SkipEmptyParts);
+        if (item.size() != 4) continue;
+        corr.add(item[0], item[1], item[2], item[3]);
+    }
+
+    corr.build();
+
+    return write(outFile, Matchings(), corr);
+}
+
+bool CorrespondenceFile::open(QString filename)
+{
+    close();
+
+    file.setFileName(filename);
+    if (!file.open(QIODevice::ReadOnly)) return false;
+    if (file.size() < qint64(sizeof(Header))) { close(); return false; }
+
+    data = file.map(0, file.size());
+    if (data == nullptr) { close(); return false; }
+
+    header = (const Header*)data;
+    if (std::memcmp(header->magic, fileMagic, 4) != 0 || header->version != currentVersion
+            || header->byteOrder != fileByteOrder) { close(); return false; }
+
+    // Section layout follows the header, sizes are summed wide so counts cannot wrap around
+    quint64 offset = sizeof(Header);
+    stringOffsets = (const quint32*)(data + offset);    offset += (quint64(header->numStrings) + 1) * sizeof(quint32);
+    stringOrder = (const quint32*)(data + offset);      offset += quint64(header->numStrings) * sizeof(quint32);
+    stringData = (const char*)(data + offset);          offset += header->stringDataSize;
+    offset = alignTo8(offset);
+    pairRecords = (const PairRecord*)(data + offset);   offset += quint64(header->numPairs) * sizeof(PairRecord);
+    matchRecords = (const MatchRecord*)(data + offset); offset += quint64(header->numMatches) * sizeof(MatchRecord);
+    corrRecords = (const CorrRecord*)(data + offset);   offset += quint64(header->numCorr) * sizeof(CorrRecord);
+    clusterRecords = (const ClusterRecord*)(data + offset); offset += quint64(header->numClusterItems) * sizeof(ClusterRecord);
+
+    // Truncated file
+    if (offset > quint64(file.size())) { close(); return false; }
+
+    // String offsets must stay inside the string data, and the sorted order must name valid strings
+    if (stringOffsets[0] != 0 || stringOffsets[header->numStrings] != header->stringDataSize) { close(); return false; }
+    for (quint32 i = 0; i < header->numStrings; i++){
+        if (stringOffsets[i] > stringOffsets[i + 1] || stringOrder[i] >= header->numStrings) { close(); return false; }
+    }
+
+    // Cluster ids size the result of clusters(), every cluster has at least one item
+    for (quint32 i = 0; i < header->numClusterItems; i++){
+        const ClusterRecord & r = clusterRecords[i];
+        if (r.cluster >= header->numClusterItems || r.shape >= header->numStrings || r.part >= header->numStrings) { close(); return false; }
+    }
+
+    return true;
+}
+
+void CorrespondenceFile::close()
+{
+    if (data != nullptr) file.unmap((uchar*)data);
+    if (file.isOpen()) file.close();
+    data = nullptr;
+}
+
+QString CorrespondenceFile::string(quint32 id) const
+{
+    if (!isOpen() || id >= header->numStrings) return QString();
+    return QString::fromUtf8(stringData + stringOffsets[id], stringOffsets[id + 1] - stringOffsets[id]);
+}
+
+quint32 CorrespondenceFile::lookup(const QString & str) const
+{
+    if (!isOpen()) return quint32(-1);
+
+    QByteArray bytes = str.toUtf8();
+
+    // Binary search over the sorted string order
+    quint32 lo = 0, hi = header->numStrings;
+    while (lo < hi){
+        quint32 mid = (lo + hi) / 2;
+        quint32 id = stringOrder[mid];
+        int c = compareBytes(stringData + stringOffsets[id], stringOffsets[id + 1] - stringOffsets[id], bytes);
+        if (c == 0) return id;
+        if (c < 0) lo = mid + 1;
+        else hi = mid;
+    }
+
+    return quint32(-1);
+}
+
+int CorrespondenceFile::numPairs() const
+{
+    return isOpen() ? header->numPairs : 0;
+}
+
+void CorrespondenceFile::pair(int i, QString & source, QString & target, double & cost, bool & isReversed) const
+{
+    const PairRecord & r = pairRecords[i];
+    source = string(r.source);
+    target = string(r.target);
+    cost = r.cost;
+    isReversed = r.isReversed != 0;
+}
+
+CorrespondenceFile::MatchingPairs CorrespondenceFile::matchingPairs(int i) const
+{
+    MatchingPairs result;
+    const PairRecord & r = pairRecords[i];
+    if (r.firstMatch > header->numMatches || r.numMatches > header->numMatches - r.firstMatch) return result;
+    for (quint32 m = r.firstMatch; m < r.firstMatch + r.numMatches; m++)
+        result << qMakePair(string(matchRecords[m].sourcePart), string(matchRecords[m].targetPart));
+    return result;
+}
+
+int CorrespondenceFile::findPair(const QString & source, const QString & target) const
+{
+    quint32 s = lookup(source), t = lookup(target);
+    if (s == quint32(-1) || t == quint32(-1)) return -1;
+
+    auto begin = pairRecords, end = pairRecords + header->numPairs;
+    auto it = std::lower_bound(begin, end, std::make_tuple(s, t), [](const PairRecord & r, const std::tuple<quint32,quint32> & k){
+        return std::tie(r.source, r.target) < k;
+    });
+
+    if (it == end || it->source != s || it->target != t) return -1;
+    return int(it - begin);
+}
+
+int CorrespondenceFile::numCorrespondences() const
+{
+    return isOpen() ? header->numCorr : 0;
+}
+
+void CorrespondenceFile::correspondence(int i, QString & source, QString & sourcePart, QString & target, QString & targetPart) const
+{
+    const CorrRecord & r = corrRecords[i];
+    source = string(r.source);
+    sourcePart = string(r.sourcePart);
+    target = string(r.target);
+    targetPart = string(r.targetPart);
+}
+
+std::pair<const CorrespondenceFile::CorrRecord*, const CorrespondenceFile::CorrRecord*>
+CorrespondenceFile::corrRange(quint32 source, quint32 sourcePart, quint32 target, int depth) const
+{
+    auto key = [depth](const CorrRecord & r){
+        return std::make_tuple(r.source, depth > 1 ? r.sourcePart : 0, depth > 2 ? r.target : 0);
+    };
+
+    CorrRecord query;
+    query.source = source;
+    query.sourcePart = sourcePart;
+    query.target = target;
+    auto q = key(query);
+
+    auto begin = corrRecords, end = corrRecords + (isOpen() ? header->numCorr : 0);
+    auto lower = std::lower_bound(begin, end, q, [&](const CorrRecord & r, decltype(q) k){ return key(r) < k; });
+    auto upper = std::upper_bound(lower, end, q, [&](decltype(q) k, const CorrRecord & r){ return k < key(r); });
+    return std::make_pair(lower, upper);
+}
+
+QStringList CorrespondenceFile::parts(const QString & source, const QString & sourcePart, const QString & target) const
+{
+    QStringList result;
+
+    quint32 s = lookup(source), p = lookup(sourcePart), t = lookup(target);
+    if (s == quint32(-1) || p == quint32(-1) || t == quint32(-1)) return result;
+
+    auto range = corrRange(s, p, t, 3);
+    for (auto it = range.first; it != range.second; ++it)
+        result << string(it->targetPart);
+
+    return result;
+}
+
+QStringList CorrespondenceFile::targets(const QString & source, const QString & sourcePart) const
+{
+    QStringList result;
+
+    quint32 s = lookup(source), p = lookup(sourcePart);
+    if (s == quint32(-1) || p == quint32(-1)) return result;
+
+    // Sorted by target within a part, equal targets are neighbours
+    auto range = corrRange(s, p, 0, 2);
+    for (auto it = range.first; it != range.second; ++it)
+        if (it == range.first || (it - 1)->target != it->target) result << string(it->target);
+
+    return result;
+}
+
+bool CorrespondenceFile::hasMatch(const QString & source, const QString & sourcePart, const QString & target) const
+{
+    quint32 s = lookup(source), p = lookup(sourcePart), t = lookup(target);
+    if (s == quint32(-1) || p == quint32(-1) || t == quint32(-1)) return false;
+
+    auto range = corrRange(s, p, t, 3);
+    return range.first != range.second;
+}
+
+bool CorrespondenceFile::hasMatch(const QString & source, const QString & sourcePart) const
+{
+    quint32 s = lookup(source), p = lookup(sourcePart);
+    if (s == quint32(-1) || p == quint32(-1)) return false;
+
+    auto range = corrRange(s, p, 0, 2);
+    return range.first != range.second;
+}
+
+bool CorrespondenceFile::containsShape(const QString & source) const
+{
+    quint32 s = lookup(source);
+    if (s == quint32(-1)) return false;
+
+    auto range = corrRange(s, 0, 0, 1);
+    return range.first != range.second;
+}
+
+QVector<QStringList> CorrespondenceFile::clusters() const
+{
+    QVector<QStringList> result;
+    if (!isOpen()) return result;
+
+    for (quint32 i = 0; i < header->numClusterItems; i++){
+        const ClusterRecord & r = clusterRecords[i];
+        while (result.size() <= int(r.cluster)) result << QStringList();
+        result[r.cluster] << string(r.shape) + ":" + string(r.part);
+    }
+
+    return result;
+}
+
+bool CorrespondenceFile::isNewerThan(QString binaryFile, QString textFile)
+{
+    QFileInfo binaryInfo(binaryFile), textInfo(textFile);
+    if (!binaryInfo.exists()) return false;
+    if (!textInfo.exists()) return true;
+    return binaryInfo.lastModified() >= textInfo.lastModified();
+}
+
+QVector<QStringList> CorrespondenceFile::readClusters(QString filename)
+{
+    QVector<QStringList> clusters;
+
+    QFile file(filename);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) return clusters;
+
+    QTextStream in(&file);
+    while (!in.atEnd()){
+        auto l = in.readLine().split("\t", QString::SkipEmptyParts);
+        if (!l.empty()) clusters << l;
+    }
+
+    return clusters;
+}
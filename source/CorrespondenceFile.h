@@ -0,0 +1,119 @@
+#pragma once
+
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include <QPair>
+#include <QMap>
+#include <QVariantMap>
+#include <QFile>
+#include <utility>
+
+class CorrespondenceIndex;
+
+// Binary on-disk form of pair-wise matchings, dataset correspondences, and part clusters.
+// The file is a header, a string table, and arrays of fixed-width records. It is memory
+// mapped when opened and queried in place, strings are only decoded when returned.
+class CorrespondenceFile
+{
+public:
+    static const quint32 currentVersion = 1;
+
+    typedef QVector< QPair<QString, QString> > MatchingPairs;
+    typedef QMap< QString, QMap< QString, QVariantMap> > Matchings;
+
+    CorrespondenceFile();
+    ~CorrespondenceFile();
+
+    // Writing
+    static bool write(QString filename, const Matchings & matchings, const CorrespondenceIndex & corr,
+                      const QVector<QStringList> & clusters = QVector<QStringList>());
+
+    // Converters from the text files
+    static bool convertPairwiseText(QString matchesFile, QString outFile);
+    static bool convertDatasetCorrText(QString corrFile, QString outFile);
+
+    // Reading
+    bool open(QString filename);
+    void close();
+    bool isOpen() const { return data != nullptr; }
+
+    // Pair-wise matchings, sorted by source then target
+    int numPairs() const;
+    void pair(int i, QString & source, QString & target, double & cost, bool & isReversed) const;
+    MatchingPairs matchingPairs(int i) const;
+    int findPair(const QString & source, const QString & target) const;
+
+    // Part correspondences, sorted by source, source part, then target
+    int numCorrespondences() const;
+    void correspondence(int i, QString & source, QString & sourcePart, QString & target, QString & targetPart) const;
+    QStringList parts(const QString & source, const QString & sourcePart, const QString & target) const;
+    QStringList targets(const QString & source, const QString & sourcePart) const;
+    bool hasMatch(const QString & source, const QString & sourcePart, const QString & target) const;
+    bool hasMatch(const QString & source, const QString & sourcePart) const;
+    bool containsShape(const QString & source) const;
+
+    // Part clusters, each is a list of "shape:part"
+    QVector<QStringList> clusters() const;
+
+    QString string(quint32 id) const;
+    quint32 lookup(const QString & str) const;
+
+    QString fileName() const { return file.fileName(); }
+
+    static bool isNewerThan(QString binaryFile, QString textFile);
+
+    // Cluster text file, a tab separated list of "shape:part" per line
+    static QVector<QStringList> readClusters(QString filename);
+
+    struct Header{
+        char magic[4];
+        quint32 version;
+        quint32 byteOrder;
+        quint32 numStrings;
+        quint32 stringDataSize;
+        quint32 numPairs;
+        quint32 numMatches;
+        quint32 numCorr;
+        quint32 numClusterItems;
+        quint32 reserved;
+    };
+
+    struct PairRecord{
+        quint32 source, target;
+        double cost;
+        quint32 isReversed;
+        quint32 firstMatch, numMatches;
+        quint32 reserved;
+    };
+
+    struct MatchRecord{
+        quint32 sourcePart, targetPart;
+    };
+
+    struct CorrRecord{
+        quint32 source, sourcePart, target, targetPart;
+    };
+
+    struct ClusterRecord{
+        quint32 cluster, shape, part;
+    };
+
+protected:
+    QFile file;
+    const uchar * data;
+
+    const Header * header;
+    const quint32 * stringOffsets;   // numStrings + 1
+    const quint32 * stringOrder;     // ids sorted by their bytes
+    const char * stringData;
+    const PairRecord * pairRecords;
+    const MatchRecord * matchRecords;
+    const CorrRecord * corrRecords;
+    const ClusterRecord * clusterRecords;
+
+    static size_t alignTo8(size_t offset){ return (offset + 7) & ~size_t(7); }
+
+    // Correspondences whose first depth ids of (source, part, target) are the given ones
+    std::pair<const CorrRecord*, const CorrRecord*> corrRange(quint32 source, quint32 sourcePart, quint32 target, int depth) const;
+};
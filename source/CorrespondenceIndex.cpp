@@ -0,0 +1,251 @@
+#include "CorrespondenceIndex.h"
+#include "CorrespondenceFile.h"
+
+#include <algorithm>
+#include <tuple>
+#include <QSet>
+
+const quint32 CorrespondenceIndex::invalid;
+
+CorrespondenceIndex::CorrespondenceIndex() : isSorted(true)
+{
+
+}
+
+quint32 CorrespondenceIndex::intern(const QString & name)
+{
+    auto it = ids.constFind(name);
+    if(it != ids.constEnd()) return it.value();
+
+    quint32 id = names.size();
+    ids.insert(name, id);
+    names.push_back(name);
+    return id;
+}
+
+quint32 CorrespondenceIndex::lookup(const QString & name) const
+{
+    return ids.value(name, invalid);
+}
+
+void CorrespondenceIndex::add(const QString & source, const QString & sourcePart, const QString & target, const QString & targetPart)
+{
+    Record r;
+    r.source = intern(source);
+    r.sourcePart = intern(sourcePart);
+    r.target = intern(target);
+    r.targetPart = intern(targetPart);
+
+    if(isSorted && !records.empty()){
+        auto & last = records.back();
+        if(std::tie(r.source, r.sourcePart, r.target) < std::tie(last.source, last.sourcePart, last.target))
+            isSorted = false;
+    }
+
+    records.push_back(r);
+}
+
+void CorrespondenceIndex::build()
+{
+    if(isSorted) return;
+
+    // Stable so that matches of a part keep the order they were added in
+    std::stable_sort(records.begin(), records.end(), [](const Record & a, const Record & b){
+        return std::tie(a.source, a.sourcePart, a.target) < std::tie(b.source, b.sourcePart, b.target);
+    });
+
+    isSorted = true;
+}
+
+void CorrespondenceIndex::clear()
+{
+    ids.clear();
+    names.clear();
+    records.clear();
+    isSorted = true;
+    files.clear();
+}
+
+void CorrespondenceIndex::attach(QSharedPointer<const CorrespondenceFile> file)
+{
+    if(file.isNull() || !file->isOpen()) return;
+
+    for(auto & f : files){
+        if(f->fileName() == file->fileName()){
+            f = file;
+            return;
+        }
+    }
+
+    files << file;
+}
+
+void CorrespondenceIndex::detach(const QString & fileName, bool isKeepRecords)
+{
+    for(int i = 0; i < files.size(); i++)
+    {
+        auto file = files[i];
+        if(file->fileName() != fileName) continue;
+
+        files.remove(i);
+
+        if(isKeepRecords){
+            QString s, p, t, q;
+            for(int j = 0; j < file->numCorrespondences(); j++){
+                file->correspondence(j, s, p, t, q);
+                add(s, p, t, q);
+            }
+            build();
+        }
+        return;
+    }
+}
+
+int CorrespondenceIndex::size() const
+{
+    int count = int(records.size());
+    for(auto & f : files) count += f->numCorrespondences();
+    return count;
+}
+
+template<typename Visitor>
+void CorrespondenceIndex::visit(quint32 source, quint32 sourcePart, quint32 target, int depth, Visitor visitor) const
+{
+    auto key = [depth](const Record & r){
+        return std::make_tuple(r.source, depth > 1 ? r.sourcePart : 0, depth > 2 ? r.target : 0);
+    };
+
+    Record query;
+    query.source = source;
+    query.sourcePart = sourcePart;
+    query.target = target;
+    auto q = key(query);
+
+    // Index not built yet, fall back to a scan
+    if(!isSorted){
+        for(auto & r : records) if(key(r) == q) visitor(r);
+        return;
+    }
+
+    auto lower = std::lower_bound(records.begin(), records.end(), q, [&](const Record & r, decltype(q) k){ return key(r) < k; });
+    for(auto it = lower; it != records.end() && key(*it) == q; ++it)
+        visitor(*it);
+}
+
+QStringList CorrespondenceIndex::parts(const QString & source, const QString & sourcePart, const QString & target) const
+{
+    QStringList result;
+
+    quint32 s = lookup(source), p = lookup(sourcePart), t = lookup(target);
+    if(s != invalid && p != invalid && t != invalid)
+        visit(s, p, t, 3, [&](const Record & r){ result << names[r.targetPart]; });
+
+    for(auto & f : files) result << f->parts(source, sourcePart, target);
+
+    return result;
+}
+
+QStringList CorrespondenceIndex::targets(const QString & source, const QString & sourcePart) const
+{
+    QSet<QString> visited;
+
+    quint32 s = lookup(source), p = lookup(sourcePart);
+    if(s != invalid && p != invalid)
+        visit(s, p, 0, 2, [&](const Record & r){ visited.insert(names[r.target]); });
+
+    for(auto & f : files)
+        for(auto target : f->targets(source, sourcePart)) visited.insert(target);
+
+    QStringList result = visited.toList();
+    result.sort();
+    return result;
+}
+
+bool CorrespondenceIndex::hasMatch(const QString & source, const QString & sourcePart, const QString & target) const
+{
+    for(auto & f : files) if(f->hasMatch(source, sourcePart, target)) return true;
+
+    quint32 s = lookup(source), p = lookup(sourcePart), t = lookup(target);
+    if(s == invalid || p == invalid || t == invalid) return false;
+
+    bool found = false;
+    visit(s, p, t, 3, [&](const Record &){ found = true; });
+    return found;
+}
+
+bool CorrespondenceIndex::hasMatch(const QString & source, const QString & sourcePart) const
+{
+    for(auto & f : files) if(f->hasMatch(source, sourcePart)) return true;
+
+    quint32 s = lookup(source), p = lookup(sourcePart);
+    if(s == invalid || p == invalid) return false;
+
+    bool found = false;
+    visit(s, p, 0, 2, [&](const Record &){ found = true; });
+    return found;
+}
+
+bool CorrespondenceIndex::containsShape(const QString & source) const
+{
+    for(auto & f : files) if(f->containsShape(source)) return true;
+
+    quint32 s = lookup(source);
+    if(s == invalid) return false;
+
+    bool found = false;
+    visit(s, 0, 0, 1, [&](const Record &){ found = true; });
+    return found;
+}
+
+void CorrespondenceIndex::record(int i, QString & source, QString & sourcePart, QString & target, QString & targetPart) const
+{
+    if(i >= int(records.size())){
+        i -= int(records.size());
+        for(auto & f : files){
+            if(i < f->numCorrespondences()){
+                f->correspondence(i, source, sourcePart, target, targetPart);
+                return;
+            }
+            i -= f->numCorrespondences();
+        }
+        return;
+    }
+
+    const Record & r = records[i];
+    source = names[r.source];
+    sourcePart = names[r.sourcePart];
+    target = names[r.target];
+    targetPart = names[r.targetPart];
+}
+
+size_t CorrespondenceIndex::memoryUsage() const
+{
+    size_t bytes = records.capacity() * sizeof(Record);
+
+    // String table and the hash from strings to ids
+    for(auto & name : names) bytes += sizeof(QString) + name.capacity() * sizeof(QChar);
+    bytes += ids.capacity() * (sizeof(QString) + sizeof(quint32) + sizeof(void*) * 2);
+
+    return bytes;
+}
+
+size_t CorrespondenceIndex::memoryUsage(const QStringList & shapes) const
+{
+    size_t bytes = 0;
+
+    QSet<quint32> usedNames;
+    for(auto shape : shapes)
+    {
+        quint32 s = lookup(shape);
+        if(s == invalid) continue;
+
+        visit(s, 0, 0, 1, [&](const Record & r){
+            bytes += sizeof(Record);
+            usedNames << r.source << r.sourcePart << r.target << r.targetPart;
+        });
+    }
+
+    for(auto id : usedNames) bytes += sizeof(QString) + names[id].capacity() * sizeof(QChar);
+
+    return bytes;
+}
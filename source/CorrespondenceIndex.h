@@ -0,0 +1,69 @@
+#pragma once
+
+#include <QString>
+#include <QStringList>
+#include <QHash>
+#include <QVector>
+#include <QSharedPointer>
+#include <vector>
+
+class CorrespondenceFile;
+
+// Part-to-part correspondences of a dataset: (source shape, source part) -> (target shape, target part)
+// Shape and part names are interned, matches are kept as flat records sorted by source, part, and target
+class CorrespondenceIndex
+{
+public:
+    CorrespondenceIndex();
+
+    // Building
+    void add(const QString & source, const QString & sourcePart, const QString & target, const QString & targetPart);
+    void build();
+    void clear();
+
+    // Records of an open file are queried in place along with added ones, a file with the
+    // same name replaces the one attached before
+    void attach(QSharedPointer<const CorrespondenceFile> file);
+
+    // Drops an attached file, its records are copied into the index first when kept. Files are
+    // detached before being rewritten
+    void detach(const QString & fileName, bool isKeepRecords);
+
+    // Queries, these never modify the index
+    QStringList parts(const QString & source, const QString & sourcePart, const QString & target) const;
+    QStringList targets(const QString & source, const QString & sourcePart) const;
+    bool hasMatch(const QString & source, const QString & sourcePart, const QString & target) const;
+    bool hasMatch(const QString & source, const QString & sourcePart) const;
+    bool containsShape(const QString & source) const;
+
+    // Added records come first, then those of the attached files
+    int size() const;
+    bool isEmpty() const { return size() == 0; }
+    void record(int i, QString & source, QString & sourcePart, QString & target, QString & targetPart) const;
+
+    // Memory used by the whole index, or by the matches starting at the given shapes. Attached
+    // files are mapped and not counted
+    size_t memoryUsage() const;
+    size_t memoryUsage(const QStringList & shapes) const;
+
+protected:
+    static const quint32 invalid = quint32(-1);
+
+    struct Record{
+        quint32 source, sourcePart, target, targetPart;
+    };
+
+    QHash<QString, quint32> ids;
+    QVector<QString> names;
+    std::vector<Record> records;
+    bool isSorted;
+
+    QVector< QSharedPointer<const CorrespondenceFile> > files;
+
+    quint32 intern(const QString & name);
+    quint32 lookup(const QString & name) const;
+
+    // Visits records matching a key prefix, depth is how many of (source, part, target) are compared
+    template<typename Visitor>
+    void visit(quint32 source, quint32 sourcePart, quint32 target, int depth, Visitor visitor) const;
+};
@@ -3,6 +3,7 @@
 
 #include "Document.h"
 #include "Model.h"
+#include "ModelHistory.h"
 #include "Viewer.h"
 
 #include <QApplication>
@@ -10,12 +11,15 @@
 #include <QProgressDialog>
 #include <QTimer>
 #include <QThread>
+#include <QSettings>
 
 #include "DocumentAnalyzeWorker.h"
+#include "CorrespondenceFile.h"
 
 Document::Document(QObject *parent) : QObject(parent)
 {
-
+    // Zero budget keeps every dataset model in memory
+    cachedModels.setBudget(size_t(QSettings().value("cache/budgetMB", 2048).toULongLong()) * 1024 * 1024);
 }
 
 bool Document::loadModel(QString filename)
@@ -42,6 +46,7 @@ void Document::saveModel(QString modelName, QString filename)
         Structure::ShapeGraph * model = m;
         if(filename.size() < 3)
             filename = model->property.contains("name") ? model->property["name"].toString() : QString("%1.xml").arg(modelName);
+        m->expandInstances();
         m->saveToFile(filename);
     }
 }
@@ -152,7 +157,7 @@ void Document::analyze(QString categoryName)
     if(!categories.keys().contains(categoryName)) return;
 
     // Create progress bar
-    auto bar = new QProgressDialog("Please wait...", QString(), 0, 100, 0);
+    auto bar = new QProgressDialog("Please wait...", "Cancel", 0, 100, 0);
     bar->setWindowTitle("Processing");
     bar->show();
     QRect screenGeometry = QApplication::desktop()->screenGeometry();
@@ -160,7 +165,7 @@ void Document::analyze(QString categoryName)
     int y = (screenGeometry.height()-bar->height()) / 2;
     bar->move(x, y);
 
-    auto worker = new DocumentAnalyzeWorker(this);
+    auto worker = new DocumentAnalyzeWorker(this, QSettings().value("analysis/numWorkers", -1).toInt());
 
     QThread* thread = new QThread;
     worker->moveToThread(thread);
@@ -169,12 +174,21 @@ void Document::analyze(QString categoryName)
     connect(worker, SIGNAL (finished()), this, SLOT (sayCategoryAnalysisDone()));
     connect(worker, SIGNAL (finished()), bar, SLOT (deleteLater()));
     connect(worker, SIGNAL (finished()), worker, SLOT (deleteLater()));
+    connect(worker, SIGNAL (cancelled()), thread, SLOT (quit()));
+    connect(worker, SIGNAL (cancelled()), bar, SLOT (deleteLater()));
+    connect(worker, SIGNAL (cancelled()), worker, SLOT (deleteLater()));
+    connect(worker, SIGNAL (failed(QString)), thread, SLOT (quit()));
+    connect(worker, SIGNAL (failed(QString)), bar, SLOT (deleteLater()));
+    connect(worker, SIGNAL (failed(QString)), worker, SLOT (deleteLater()));
     connect(thread, SIGNAL (finished()), thread, SLOT (deleteLater()));
 
     // Connect progress bar to worker
     bar->connect(worker, SIGNAL(progress(int)), SLOT(setValue(int)));
     bar->connect(worker, SIGNAL(progressText(QString)), SLOT(setLabelText(QString)));
 
+    // Worker thread is busy, cancel is only a flag checked between pairs
+    connect(bar, &QProgressDialog::canceled, worker, &DocumentAnalyzeWorker::cancel, Qt::DirectConnection);
+
     thread->start(QThread::HighestPriority);
 }
 
@@ -183,7 +197,7 @@ void Document::computePairwise(QString categoryName)
     if(!categories.keys().contains(categoryName)) return;
 
     // Create progress bar
-    auto bar = new QProgressDialog("Please wait...", QString(), 0, 100, 0);
+    auto bar = new QProgressDialog("Please wait...", "Cancel", 0, 100, 0);
     bar->setWindowTitle("Processing");
     bar->show();
     QRect screenGeometry = QApplication::desktop()->screenGeometry();
@@ -191,7 +205,7 @@ void Document::computePairwise(QString categoryName)
     int y = (screenGeometry.height()-bar->height()) / 2;
     bar->move(x, y);
 
-    auto worker = new DocumentAnalyzeWorker(this);
+    auto worker = new DocumentAnalyzeWorker(this, QSettings().value("analysis/numWorkers", -1).toInt());
 
     QThread* thread = new QThread;
 
@@ -201,12 +215,21 @@ void Document::computePairwise(QString categoryName)
     connect(worker, SIGNAL (finished()), this, SLOT (sayPairwiseAnalysisDone()));
     connect(worker, SIGNAL (finished()), bar, SLOT (deleteLater()));
     connect(worker, SIGNAL (finished()), worker, SLOT (deleteLater()));
+    connect(worker, SIGNAL (cancelled()), thread, SLOT (quit()));
+    connect(worker, SIGNAL (cancelled()), bar, SLOT (deleteLater()));
+    connect(worker, SIGNAL (cancelled()), worker, SLOT (deleteLater()));
+    connect(worker, SIGNAL (failed(QString)), thread, SLOT (quit()));
+    connect(worker, SIGNAL (failed(QString)), bar, SLOT (deleteLater()));
+    connect(worker, SIGNAL (failed(QString)), worker, SLOT (deleteLater()));
     connect(thread, SIGNAL (finished()), thread, SLOT (deleteLater()));
 
     // Connect progress bar to worker
     bar->connect(worker, SIGNAL(progress(int)), SLOT(setValue(int)));
     bar->connect(worker, SIGNAL(progressText(QString)), SLOT(setLabelText(QString)));
 
+    // Worker thread is busy, cancel is only a flag checked between pairs
+    connect(bar, &QProgressDialog::canceled, worker, &DocumentAnalyzeWorker::cancel, Qt::DirectConnection);
+
     thread->start(QThread::HighestPriority);
 }
 
@@ -225,44 +248,126 @@ void Document::sayGlobalSettingsChanged()
     emit(globalSettingsChanged());
 }
 
+double Document::matchingCost(QString source, QString target) const
+{
+    auto s = datasetMatching.constFind(source);
+    if (s != datasetMatching.constEnd() && s->contains(target)) return s->value(target).value("min_cost").toDouble();
+
+    // Loaded costs count for both directions
+    if (pairwiseFile.isNull()) return 0;
+    int i = pairwiseFile->findPair(source, target);
+    if (i < 0) i = pairwiseFile->findPair(target, source);
+    if (i < 0) return 0;
+
+    QString a, b;
+    double cost;
+    bool isReversed;
+    pairwiseFile->pair(i, a, b, cost, isReversed);
+    return cost;
+}
+
 void Document::savePairwise(QString filename)
 {
+	// Computed matchings, then loaded ones that were not computed again
+	Matchings matchings = datasetMatching;
+	if (!pairwiseFile.isNull())
+	{
+		QString s, t;
+		double cost;
+		bool isReversed;
+
+		for (int i = 0; i < pairwiseFile->numPairs(); i++){
+			pairwiseFile->pair(i, s, t, cost, isReversed);
+			if (matchings.value(s).contains(t)) continue;
+			matchings[s][t]["min_cost"] = cost;
+			matchings[s][t]["isReversed"] = isReversed;
+			matchings[s][t]["matching_pairs"].setValue(pairwiseFile->matchingPairs(i));
+		}
+	}
+
 	// Pair-wise distances
 	{
 		QFile file(filename);
 		if (!file.open(QIODevice::WriteOnly | QIODevice::Text)) return;
 		QTextStream out(&file);
-		for (auto s : datasetMatching.keys())
-			for (auto t : datasetMatching[s].keys())
-				out << s << " " << t << " " << datasetMatching[s][t]["min_cost"].toDouble() << "\n";
+		for (auto s : matchings.keys())
+			for (auto t : matchings[s].keys())
+				out << s << " " << t << " " << matchings[s][t]["min_cost"].toDouble() << "\n";
 	}
 
-	// Full dataset matches
+	CorrespondenceIndex fileCorr;
+
+	// Full dataset matches, only computed ones are new to the dataset correspondence
 	{
 		QFile file(filename + ".match");
 		if (!file.open(QIODevice::WriteOnly | QIODevice::Text)) return;
 		QTextStream out(&file);
-		for (auto s : datasetMatching.keys()){
-			for (auto t : datasetMatching[s].keys()){
+		for (auto s : matchings.keys()){
+			for (auto t : matchings[s].keys()){
+				bool isComputed = datasetMatching.value(s).contains(t);
 				QStringList matches;
-				QVector< QPair<QString, QString> > mp = datasetMatching[s][t]["matching_pairs"].value< QVector< QPair<QString, QString> > >();
+				QVector< QPair<QString, QString> > mp = matchings[s][t]["matching_pairs"].value< QVector< QPair<QString, QString> > >();
                 for (auto p : mp)
                 {
-                    if(datasetMatching[s][t]["isReversed"].toBool()) std::swap(p.first, p.second);
+                    if(matchings[s][t]["isReversed"].toBool()) std::swap(p.first, p.second);
 
 					matches << QString("%1,%2").arg(p.first).arg(p.second);
 
-					datasetCorr[s][p.first][t] << p.second;
-					datasetCorr[t][p.second][s] << p.first;
+					fileCorr.add(s, p.first, t, p.second);
+					fileCorr.add(t, p.second, s, p.first);
+					if (!isComputed) continue;
+					datasetCorr.add(s, p.first, t, p.second);
+					datasetCorr.add(t, p.second, s, p.first);
 				}
 				out << s << " " << t << " " << matches.join("|") << "\n";
 			}
 		}
 	}
+
+	datasetCorr.build();
+	fileCorr.build();
+
+	// Clusters are carried over, from the ones applied or else the text file
+	auto clusters = partClusters;
+	if (clusters.empty()) clusters = CorrespondenceFile::readClusters(filename + ".cluster");
+
+	// The mapped file is released before it is rewritten, its records stay in memory
+	QString binaryFile = filename + ".bin";
+	if (!pairwiseFile.isNull() && pairwiseFile->fileName() == binaryFile){
+		for (auto s : matchings.keys())
+			for (auto t : matchings[s].keys()) datasetMatching[s][t] = matchings[s][t];
+		datasetCorr.detach(binaryFile, true);
+		pairwiseFile.clear();
+	}
+
+	// Binary form for fast loading
+	CorrespondenceFile::write(binaryFile, matchings, fileCorr, clusters);
 }
 
 void Document::loadPairwise(QString filename)
 {
+	// Use the binary form, converting the text files when they are newer. A file mapped by an
+	// earlier load is released first, its records are replaced by the new ones
+	QString binaryFile = filename + ".bin";
+	if (!CorrespondenceFile::isNewerThan(binaryFile, filename) ||
+		!CorrespondenceFile::isNewerThan(binaryFile, filename + ".match") ||
+		!CorrespondenceFile::isNewerThan(binaryFile, filename + ".cluster"))
+	{
+		datasetCorr.detach(binaryFile, false);
+		if (!pairwiseFile.isNull() && pairwiseFile->fileName() == binaryFile) pairwiseFile.clear();
+		CorrespondenceFile::convertPairwiseText(filename, binaryFile);
+	}
+
+	// Matchings and correspondences are queried from the mapped file without decoding them
+	auto binary = QSharedPointer<CorrespondenceFile>(new CorrespondenceFile());
+	if (binary->open(binaryFile))
+	{
+		pairwiseFile = binary;
+		datasetCorr.attach(binary);
+		applyPartClusters(binary->clusters());
+		return;
+	}
+
 	// Pair-wise distances
 	{
 		QFile file(filename);
@@ -297,10 +402,12 @@ void Document::loadPairwise(QString filename)
 			{
 				auto p = txtPair.split(",", QString::SkipEmptyParts);
 
-				datasetCorr[s][p.front()][t] << p.back();
-				datasetCorr[t][p.back()][s] << p.front();
+				datasetCorr.add(s, p.front(), t, p.back());
+				datasetCorr.add(t, p.back(), s, p.front());
 			}
 		}
+
+		datasetCorr.build();
 	}
 
     // Load clustering file if any
@@ -311,47 +418,78 @@ void Document::loadPairwise(QString filename)
         QTextStream in(&file);
         auto lines = in.readAll().split(QRegExp("[\r\n]"), QString::SkipEmptyParts);
 
-        QVector<QColor> cluster_colors;
+        QVector<QStringList> clusters;
+        for (auto line : lines) clusters << line.split("\t", QString::SkipEmptyParts);
 
-        // Intresting colors
-        /*
-        auto paired_colors = { "#a6cee3", "#1f78b4", "#b2df8a", "#33a02c", "#fb9a99", "#e31a1c",
-                    "#fdbf6f", "#ff7f00", "#cab2d6", "#6a3d9a", "#ffff99", "#b15928",
-                    "#4D4D4D", "#5DA5DA", "#FAA43A", "#60BD68", "#F17CB0", "#B2912F", "#B276B2", "#DECF3F", "#F15854",
-                    "#e41a1c", "#377eb8", "#4daf4a", "#984ea3", "#ff7f00", "#ffff33", "#a65628", "#f781bf" };
-        int num_paired_colors = paired_colors.size();
-        for (int i = 0; i < num_paired_colors; i++){
-            QColor c;
-            c.setNamedColor(*(paired_colors.begin() + i));
-            cluster_colors << c;
-        }*/
+        applyPartClusters(clusters);
+    }
+}
 
+void Document::applyPartClusters(QVector<QStringList> clusters)
+{
+    if(clusters.empty()) return;
+    partClusters = clusters;
 
-        cluster_colors << QColor(255, 97, 121) << QColor(255, 219, 88) << QColor(107, 255, 135) << QColor(255, 165, 107) << QColor(104, 126, 255) <<
-                        QColor(242, 5, 135) << QColor(138, 0, 242) << QColor(3, 166, 60) << QColor(242, 203, 5);
+    QVector<QColor> cluster_colors;
 
+    // Intresting colors
+    /*
+    auto paired_colors = { "#a6cee3", "#1f78b4", "#b2df8a", "#33a02c", "#fb9a99", "#e31a1c",
+                "#fdbf6f", "#ff7f00", "#cab2d6", "#6a3d9a", "#ffff99", "#b15928",
+                "#4D4D4D", "#5DA5DA", "#FAA43A", "#60BD68", "#F17CB0", "#B2912F", "#B276B2", "#DECF3F", "#F15854",
+                "#e41a1c", "#377eb8", "#4daf4a", "#984ea3", "#ff7f00", "#ffff33", "#a65628", "#f781bf" };
+    int num_paired_colors = paired_colors.size();
+    for (int i = 0; i < num_paired_colors; i++){
+        QColor c;
+        c.setNamedColor(*(paired_colors.begin() + i));
+        cluster_colors << c;
+    }*/
 
-        // Generate random colors
-        srand(time(0));
-        for(int c = 0; c < lines.size(); c++) cluster_colors << starlab::qRandomColor2();
 
-        std::random_device rd;
-        std::mt19937 g(rd());
-        std::shuffle(cluster_colors.begin(), cluster_colors.end(), g);
+    cluster_colors << QColor(255, 97, 121) << QColor(255, 219, 88) << QColor(107, 255, 135) << QColor(255, 165, 107) << QColor(104, 126, 255) <<
+                    QColor(242, 5, 135) << QColor(138, 0, 242) << QColor(3, 166, 60) << QColor(242, 203, 5);
 
-        for (int i = 0; i < lines.size(); i++)
-        {
-            auto line = lines[i];
 
-            auto l = line.split("\t", QString::SkipEmptyParts);
+    // Generate random colors
+    srand(time(0));
+    for(int c = 0; c < clusters.size(); c++) cluster_colors << starlab::qRandomColor2();
 
-            for(auto shapePart : l)
-            {
-                auto p = shapePart.split(":");
-                cacheModel(p.front())->setColorFor(p.back(), cluster_colors[i]);
-            }
+    std::random_device rd;
+    std::mt19937 g(rd());
+    std::shuffle(cluster_colors.begin(), cluster_colors.end(), g);
+
+    // Colors outlive the cached models, evicted models get them again when reloaded
+    QHash< QString, QHash<QString, QColor> > colors;
+    for (int i = 0; i < clusters.size(); i++)
+    {
+        for(auto shapePart : clusters[i])
+        {
+            auto p = shapePart.split(":");
+            colors[p.front()][p.back()] = cluster_colors[i];
         }
     }
+
+    // Prefetch threads may be coloring models they just loaded
+    {
+        QMutexLocker locker(&partColorsMutex);
+        partColors = colors;
+    }
+
+    for(auto shape : colors.keys())
+    {
+        auto m = cacheModel(shape);
+        if(!m.isNull()) applyPartColors(shape, m.data());
+    }
+}
+
+void Document::applyPartColors(QString name, Model * m)
+{
+    QHash<QString, QColor> colors;
+    {
+        QMutexLocker locker(&partColorsMutex);
+        colors = partColors.value(name);
+    }
+    for(auto part : colors.keys()) m->setColorFor(part, colors[part]);
 }
 
 void Document::saveDatasetCorr(QString filename)
@@ -361,15 +499,34 @@ void Document::saveDatasetCorr(QString filename)
 
 	QTextStream out(&file);
 
-    for (auto s : datasetCorr.keys())
-        for (auto p : datasetCorr[s].keys())
-            for (auto t : datasetCorr[s][p].keys())
-                for (auto q : datasetCorr[s][p][t])
-                    out << s << " " << p << " " << t << " " << q << "\n";
+    QString s, p, t, q;
+    for (int i = 0; i < datasetCorr.size(); i++){
+        datasetCorr.record(i, s, p, t, q);
+        out << s << " " << p << " " << t << " " << q << "\n";
+    }
+
+    // Binary form for fast loading, a mapped copy is released before it is rewritten
+    datasetCorr.detach(filename + ".bin", true);
+    CorrespondenceFile::write(filename + ".bin", Matchings(), datasetCorr);
 }
 
 void Document::loadDatasetCorr(QString filename)
 {
+    // Use the binary form, converting the text file when it is newer
+    QString binaryFile = filename + ".bin";
+    if (!CorrespondenceFile::isNewerThan(binaryFile, filename)){
+        datasetCorr.detach(binaryFile, false);
+        CorrespondenceFile::convertDatasetCorrText(filename, binaryFile);
+    }
+
+    // Correspondences are queried from the mapped file without decoding them
+    auto binary = QSharedPointer<CorrespondenceFile>(new CorrespondenceFile());
+    if (binary->open(binaryFile))
+    {
+        datasetCorr.attach(binary);
+        return;
+    }
+
     QFile file(filename);
 	if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) return;
 
@@ -379,8 +536,15 @@ void Document::loadDatasetCorr(QString filename)
 	for (auto line : lines){
 		auto item = line.split(QRegExp("[ \t]"), QString::SkipEmptyParts);
         if (item.size() != 4) continue;
-        datasetCorr[item[0]][item[1]][item[2]].push_back(item[3]);
+        datasetCorr.add(item[0], item[1], item[2], item[3]);
     }
+
+    datasetCorr.build();
+}
+
+size_t Document::datasetCorrMemory(QString categoryName)
+{
+    return datasetCorr.memoryUsage(categories.value(categoryName).toStringList());
 }
 
 void Document::drawModel(QString name, QWidget *widget)
@@ -395,13 +559,17 @@ void Document::drawModel(QString name, QWidget *widget)
 void Document::createCurveFromPoints(QString modelName, QVector<QVector3D> & points)
 {
     auto m = getModel(modelName);
-    if(m != nullptr) m->createCurveFromPoints(points);
+    if(m == nullptr) return;
+    m->undoHistory()->record("Sketch curve");
+    m->createCurveFromPoints(points);
 }
 
 void Document::createSheetFromPoints(QString modelName, QVector<QVector3D> & points)
 {
     auto m = getModel(modelName);
-    if(m != nullptr) m->createSheetFromPoints(points);
+    if(m == nullptr) return;
+    m->undoHistory()->record("Sketch sheet");
+    m->createSheetFromPoints(points);
 }
 
 void Document::duplicateActiveNodeViz(QString modelName, QString duplicationOp)
@@ -413,13 +581,17 @@ void Document::duplicateActiveNodeViz(QString modelName, QString duplicationOp)
 void Document::duplicateActiveNode(QString modelName, QString duplicationOp)
 {
     auto m = getModel(modelName);
-    if(m != nullptr) m->duplicateActiveNode(duplicationOp);
+    if(m == nullptr) return;
+    m->undoHistory()->record("Duplicate");
+    m->duplicateActiveNode(duplicationOp);
 }
 
 void Document::modifyActiveNode(QString modelName, QVector<QVector3D> &guidePoints)
 {
     auto m = getModel(modelName);
-    if(m != nullptr) m->modifyLastAdded(guidePoints);
+    if(m == nullptr) return;
+    m->undoHistory()->record("Modify part");
+    m->modifyLastAdded(guidePoints);
 }
 
 void Document::setModelProperty(QString modelName, QString propertyName, QVariant propertyValue)
@@ -431,13 +603,17 @@ void Document::setModelProperty(QString modelName, QString propertyName, QVarian
 void Document::generateSurface(QString modelName, double offset)
 {
     auto m = getModel(modelName);
-    if(m != nullptr) m->generateSurface(offset);
+    if(m == nullptr) return;
+    m->undoHistory()->record("Remesh");
+    m->generateSurface(offset);
 }
 
 void Document::placeOnGround(QString modelName)
 {
     auto m = getModel(modelName);
-    if(m != nullptr) m->placeOnGround();
+    if(m == nullptr) return;
+    m->undoHistory()->record("Place on ground");
+    m->placeOnGround();
 }
 
 void Document::selectPart(QString modelName, QVector3D rayOrigin, QVector3D rayDirection)
@@ -464,11 +640,26 @@ QVector3D Document::centerActiveNode(QString modelName)
 void Document::removeActiveNode(QString modelName)
 {
     auto m = getModel(modelName);
-    if(m == nullptr) return;
+    if(m == nullptr || m->activeNode == nullptr) return;
+
+    m->undoHistory()->record("Remove part");
 
     QString nid = m->activeNode->id;
     m->removeNode(nid);
     m->activeNode = nullptr;
+    m->invalidateGeometry();
+}
+
+bool Document::undo(QString modelName)
+{
+    auto m = getModel(modelName);
+    return m != nullptr && m->undoHistory()->undo();
+}
+
+bool Document::redo(QString modelName)
+{
+    auto m = getModel(modelName);
+    return m != nullptr && m->undoHistory()->redo();
 }
 
 QString Document::firstModelName()
@@ -493,19 +684,28 @@ Model* Document::getModel(QString name)
     return nullptr;
 }
 
-Model* Document::cacheModel(QString name)
+QSharedPointer<Model> Document::cacheModel(QString name)
 {
-    if(cachedModels.contains(name)){
-        return cachedModels[name].data();
-    }else{
-        if(!dataset.contains(name)) return nullptr;
-        QString filename = dataset[name]["graphFile"].toString();
+    auto cached = cachedModels.get(name);
+    if(!cached.isNull()) return cached;
 
-        auto model = QSharedPointer<Model>(new Model());
-        if(!model->loadFromFile(filename)) return nullptr;
-        cachedModels[name] = model;
-        return model.data();
-    }
+    if(!dataset.contains(name)) return QSharedPointer<Model>();
+    QString filename = dataset[name]["graphFile"].toString();
+
+    auto model = ModelCache::newModel();
+    if(!model->loadFromFile(filename)) return QSharedPointer<Model>();
+    applyPartColors(name, model.data());
+    return cachedModels.insert(name, model);
+}
+
+void Document::pinModel(QString name)
+{
+    if(!cacheModel(name).isNull()) cachedModels.pin(name);
+}
+
+void Document::unpinModel(QString name)
+{
+    cachedModels.unpin(name);
 }
 
 Structure::ShapeGraph * Document::cloneAsShapeGraph(Model * m)
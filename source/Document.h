@@ -4,9 +4,16 @@
 #include <QVector>
 #include <QSharedPointer>
 #include <QVariantMap>
+#include <QHash>
+#include <QColor>
+#include <QMutex>
+
+#include "CorrespondenceIndex.h"
+#include "ModelCache.h"
 
 namespace Structure{ struct ShapeGraph; }
 class Model;
+class CorrespondenceFile;
 namespace opengp{ namespace SurfaceMesh{ class SurfaceMeshModel; } }
 
 class Document : public QObject
@@ -31,17 +38,27 @@ public:
     QString categoryOf(QString modelName);
 
 	// Computed correspondence
-    QMap< QString, QMap< QString, QMap<QString,QStringList> > > datasetCorr;
+    CorrespondenceIndex datasetCorr;
+    size_t datasetCorrMemory(QString categoryName);
     void analyze(QString categoryName);
 	void saveDatasetCorr(QString filename);
     void loadDatasetCorr(QString filename);
 
-    // Compute pair-wise model matchings
-    QMap< QString, QMap< QString, QVariantMap> > datasetMatching;
+    // Compute pair-wise model matchings. Computed ones are kept in datasetMatching, loaded ones
+    // are queried from the mapped binary file
+    typedef QMap< QString, QMap< QString, QVariantMap> > Matchings;
+    Matchings datasetMatching;
+    QSharedPointer<CorrespondenceFile> pairwiseFile;
+    double matchingCost(QString source, QString target) const;
     void computePairwise(QString categoryName);
     void savePairwise(QString filename);
     void loadPairwise(QString filename);
 
+    // Groups of "shape:part" colored alike, last loaded or applied, and the color of each part
+    QVector<QStringList> partClusters;
+    QHash< QString, QHash<QString, QColor> > partColors;
+    void applyPartColors(QString name, Model * m);
+
     // Visualization:
     void drawModel(QString modelName, QWidget * widget);
 
@@ -63,6 +80,10 @@ public:
     QVector3D centerActiveNode(QString modelName);
     void removeActiveNode(QString modelName);
 
+    // Edits above are recorded, false when there is nothing to undo or redo
+    bool undo(QString modelName);
+    bool redo(QString modelName);
+
     // Stats:
     QString firstModelName();
     QVector3D extent();
@@ -70,17 +91,22 @@ public:
 	// Direct access to models
 	Model * getModel(QString name);
 
-    // Memory access of dataset
-    Model * cacheModel(QString name);
+    // Memory access of dataset, hold on to the model while using it as it may be evicted
+    QSharedPointer<Model> cacheModel(QString name);
+    void pinModel(QString name);
+    void unpinModel(QString name);
+    ModelCache cachedModels;
 
 	// Helper function
 	Structure::ShapeGraph * cloneAsShapeGraph(Model * m);
 
 protected:
     QVector< QSharedPointer<Model> > models;
-    QMap< QString, QSharedPointer<Model> > cachedModels;
     QVariantMap options;
 
+    void applyPartClusters(QVector<QStringList> clusters);
+    QMutex partColorsMutex;
+
 signals:
     void analyzeProgress(int);
     void categoryAnalysisDone();
@@ -2,9 +2,14 @@
 
 #include <iostream>
 #include <QThread>
+#include <QDir>
+#include <QFileInfo>
+#include <QCryptographicHash>
+#include <QtEndian>
 
-#include "BatchProcess.h"
-#include "ShapeGraph.h"
+#include "CorrespondenceEngine.h"
+#include "PairwiseStore.h"
+#include "ModelPrefetcher.h"
 
 void DocumentAnalyzeWorker::processAllPairWise()
 {
@@ -14,108 +19,202 @@ void DocumentAnalyzeWorker::processAllPairWise()
     // Get names of shapes of selected category into memory
     auto catModels = document->categories[ document->currentCategory ].toStringList();
 
-    // Load all shapes into memory
-    for(int i = 0; i < catModels.size(); i++){
-        document->cacheModel(catModels.at(i));
-        emit(progress(loadShapesPercent * (double(i) / (catModels.size()-1))));
-    }
+    // Load all shapes into memory in parallel, pinned until analysis is done
+    ModelPrefetcher prefetcher(document, numWorkers);
+    connect(&prefetcher, &ModelPrefetcher::progress, [&](int numDone, int numTotal){
+        emit(progress(loadShapesPercent * (double(numDone) / numTotal)));
+    });
+    prefetcher.prefetch(catModels, true);
 
-    // Check for existing results
     QString matching_file = document->datasetPath + "/" + document->currentCategory + "_matches.txt";
-    if(QFileInfo(matching_file).exists()){
+    QString store_file = document->datasetPath + "/corr/" + document->currentCategory + "_pairs.txt";
+
+    bool isSharded = numShards > 1;
+
+    // Results computed before per-pair results were stored are used as they are
+    if(!isSharded && !isMergeShards && QFileInfo(matching_file).exists() && !QFileInfo(store_file).exists()){
         document->loadPairwise(matching_file);
         emit(progress(100));
+        prefetcher.waitForDone();
+        unpinModels(catModels);
         emit(finished());
         return;
     }
 
     int k = 4; // search parameter
 
-    int numPairwise = ((catModels.size()-1) * catModels.size()) / 2.0;
-    int c = 0;
+    QVariantMap options = CorrespondenceEngine::defaultOptions(k);
+    options["isAllowCutsJoins"].setValue(true);
+
+    // Previously computed pairs
+    PairwiseStore store(isSharded ? shardFileName(store_file, shardIndex, numShards) : store_file);
+    store.load();
+
+    // Shards also reuse pairs already in the category store
+    if(isSharded) store.loadFrom(store_file);
+
+    // Collect results of every shard into the category store
+    if(isMergeShards)
+    {
+        QFileInfo info(store_file);
+        auto shardFiles = QDir(info.absolutePath()).entryList(QStringList() << info.completeBaseName() + ".shard-*.txt", QDir::Files);
+        for(auto shardFile : shardFiles){
+            int numAdded = store.merge(info.absolutePath() + "/" + shardFile);
+            emit(progressText(QString("Merged %1 pairs from %2").arg(numAdded).arg(shardFile)));
+        }
+    }
+
+    QString optionsHash = PairwiseStore::optionsHash(options);
+    QMap<QString, QString> shapeHash;
+    for(auto shape : catModels){
+        // Hashed as soon as each shape is parsed
+        auto m = prefetcher.wait(shape);
+        if(m != nullptr) shapeHash[shape] = PairwiseStore::shapeHash(m);
+    }
+
+    emit(progressText(prefetcher.throughputText()));
 
+    // One job per unordered pair of shapes that has no stored result
+    QVector<CorrespondenceEngine::PairJob> jobs;
+    QStringList jobKeys;
+    QSet<QString> liveKeys;
+    int numPairs = catModels.size() * (catModels.size() - 1) / 2, pairIndex = -1;
     for(int i = 0; i < catModels.size(); i++)
     {
         for(int j = i+1; j < catModels.size(); j++)
         {
-            QString sourceName = catModels.at(i);
-            QString targetName = catModels.at(j);
-
-            emit(progressText(QString("Processing: %1-%2").arg(sourceName).arg(targetName)));
-
-            auto cachedShapeA = document->cacheModel(sourceName);
-            auto cachedShapeB = document->cacheModel(targetName);
-
-            QString sourceShape = "CACHED_" + sourceName;
-            QString targetShape = "CACHED_" + targetName;
-
-            QVariantMap options;
-            options["roundtrip"].setValue(true);
-            options["k"].setValue( k );
-            options["isQuietMode"].setValue(true);
-            options["isManyTypesJobs"].setValue(true);
-            options["isAllowCutsJoins"].setValue(true);
-
-            int numJobs = 0;
-
-            QVector< QVector<QVariantMap> > reports;
-
-            // Perform correspondence search
-            {
-                // First pass source to target
-                {
-                    auto bp = QSharedPointer<BatchProcess>(new BatchProcess(sourceShape, targetShape, options));
-                    bp->cachedShapeA = QSharedPointer<Structure::ShapeGraph>(document->cloneAsShapeGraph(cachedShapeA));
-                    bp->cachedShapeB = QSharedPointer<Structure::ShapeGraph>(document->cloneAsShapeGraph(cachedShapeB));
-                    bp->jobUID = numJobs++;
-                    bp->run();
-                    reports << bp->jobReports;
-                }
-
-                // Second pass target to source
-                if (options["roundtrip"].toBool())
-                {
-                    auto bp2 = QSharedPointer<BatchProcess>(new BatchProcess(targetShape, sourceShape, options));
-                    bp2->cachedShapeA = QSharedPointer<Structure::ShapeGraph>(document->cloneAsShapeGraph(cachedShapeB));
-                    bp2->cachedShapeB = QSharedPointer<Structure::ShapeGraph>(document->cloneAsShapeGraph(cachedShapeA));
-                    bp2->jobUID = numJobs++;
-                    bp2->run();
-                    reports << bp2->jobReports;
-                }
+            pairIndex++;
+
+            QString key = PairwiseStore::pairKey(shapeHash[catModels.at(i)], shapeHash[catModels.at(j)], optionsHash);
+            QString reverseKey = PairwiseStore::pairKey(shapeHash[catModels.at(j)], shapeHash[catModels.at(i)], optionsHash);
+            liveKeys << key << reverseKey;
+
+            if(!isInShard(pairIndex, numPairs, catModels.at(i), catModels.at(j))) continue;
+
+            CorrespondenceEngine::PairJob job;
+            job.source = catModels.at(i);
+            job.target = catModels.at(j);
+            // Category models are pinned by the prefetcher until the end of the pass
+            job.sourceModel = document->cacheModel(job.source).data();
+            job.targetModel = document->cacheModel(job.target).data();
+            job.options = options;
+            if(job.sourceModel == nullptr || job.targetModel == nullptr) continue;
+
+            if(store.contains(key)){
+                document->datasetMatching[job.source][job.target] = store.get(key);
+                continue;
             }
 
-            // Look at reports
-            double minEnergy = 1.0;
-            int totalTime = 0;
-            QVariantMap minJob;
-            for (auto & reportVec : reports){
-                for (auto & report : reportVec){
-                    totalTime += report["search_time"].toInt();
-                    double c = report["min_cost"].toDouble();
-                    if (c < minEnergy){
-                        minEnergy = c;
-                        minJob = report;
-                    }
-                }
+            // Same pair stored the other way around, matching pairs are then read swapped
+            if(store.contains(reverseKey)){
+                auto result = store.get(reverseKey);
+                result["isReversed"].setValue(!result["isReversed"].toBool());
+                document->datasetMatching[job.source][job.target] = result;
+                continue;
             }
 
-            auto firstReport = reports.front().front();
-            if (minJob["job_uid"].toInt() != firstReport["job_uid"].toInt()) minJob["isReversed"].setValue(true);
+            jobs << job;
+            jobKeys << key;
+        }
+    }
 
-            // Record result
-            document->datasetMatching[sourceName][targetName] = minJob;
+    // Results of changed shapes or options are dropped once they outnumber current ones
+    if(store.compact(liveKeys)) emit(progressText(QString("Compacted %1").arg(store.fileName())));
 
-            c++;
-            emit(progress(loadShapesPercent + (computeCorrespodPercent * (double(c) / numPairwise))));
-        }
+    // Merging never computes, missing pairs mean a shard has not finished
+    if(isMergeShards && !jobs.empty()){
+        failureText = QString("Merge incomplete: %1 pairs missing from the shards").arg(jobs.size());
+        unpinModels(catModels);
+        emit(failed(failureText));
+        return;
+    }
+
+    // Nothing new to compute
+    if(jobs.empty() && isSharded){
+        emit(progress(100));
+        unpinModels(catModels);
+        emit(finished());
+        return;
+    }
+
+    if(jobs.empty() && !isMergeShards && QFileInfo(matching_file).exists()){
+        document->loadPairwise(matching_file);
+        emit(progress(100));
+        unpinModels(catModels);
+        emit(finished());
+        return;
+    }
+
+    if(store.size()) emit(progressText(QString("Resuming: %1 pairs left to compute").arg(jobs.size())));
+
+    CorrespondenceEngine engine(numWorkers, &cancelRequested);
+
+    connect(&engine, &CorrespondenceEngine::jobStarted, [&](int jobIndex){
+        emit(progressText(QString("Processing: %1-%2").arg(jobs.at(jobIndex).source).arg(jobs.at(jobIndex).target)));
+    });
+    connect(&engine, &CorrespondenceEngine::jobFinished, [&](int jobIndex){
+        auto & job = jobs.at(jobIndex);
+        store.insert(jobKeys.at(jobIndex), job.source, job.target, job.result);
+    });
+    connect(&engine, &CorrespondenceEngine::progress, [&](int numDone, int numJobs){
+        emit(progress(loadShapesPercent + (computeCorrespodPercent * (double(numDone) / numJobs))));
+    });
+
+    engine.run(jobs);
+    emit(progressText(engine.statsText()));
+
+    // Record results
+    int numDone = 0;
+    for(auto & job : jobs){
+        if(!job.isDone) continue;
+        document->datasetMatching[job.source][job.target] = job.result;
+        numDone++;
+    }
+
+    // Partial results stay in the store only, the next run picks up from there
+    if(isCancelled()){
+        emit(progressText(QString("Cancelled: %1 of %2 pairs computed").arg(numDone).arg(jobs.size())));
+        unpinModels(catModels);
+        emit(cancelled());
+        return;
+    }
+
+    // Shards only fill their own store, the merge writes the canonical files
+    if(isSharded){
+        emit(progressText(QString("Shard %1 of %2: %3 pairs computed").arg(shardIndex + 1).arg(numShards).arg(numDone)));
+        unpinModels(catModels);
+        emit(finished());
+        return;
     }
 
     // Save results to disk
     document->savePairwise(matching_file);
 
+    unpinModels(catModels);
     emit(finished());
 }
 
+bool DocumentAnalyzeWorker::isInShard(int pairIndex, int numPairs, QString source, QString target)
+{
+    if(numShards < 2) return true;
+
+    // Stable across processes and machines, unlike qHash
+    if(isShardByHash){
+        auto digest = QCryptographicHash::hash(QString(source + "|" + target).toUtf8(), QCryptographicHash::Md5);
+        quint32 h = qFromBigEndian<quint32>((const uchar*)digest.constData());
+        return int(h % quint32(numShards)) == shardIndex;
+    }
+
+    // Contiguous blocks of the pair enumeration
+    return int(qint64(pairIndex) * numShards / numPairs) == shardIndex;
+}
+
+QString DocumentAnalyzeWorker::shardFileName(QString storeFile, int shardIndex, int numShards)
+{
+    QFileInfo info(storeFile);
+    return QString("%1/%2.shard-%3-of-%4.txt").arg(info.absolutePath()).arg(info.completeBaseName()).arg(shardIndex).arg(numShards);
+}
+
 void DocumentAnalyzeWorker::processShapeDataset()
 {
 	QString sourceName = document->firstModelName();
@@ -126,13 +225,12 @@ void DocumentAnalyzeWorker::processShapeDataset()
     // Get names of shapes of selected category into memory
     auto catModels = document->categories[ document->currentCategory ].toStringList();
 	  
-    // Load all shapes into memory
-    for(int i = 0; i < catModels.size(); i++)
-    {
-        document->cacheModel(catModels.at(i));
-
-        emit(progress(loadShapesPercent * (double(i) / (catModels.size()-1))));
-    }
+    // Load all shapes into memory in parallel, pinned until analysis is done
+    ModelPrefetcher prefetcher(document, numWorkers);
+    connect(&prefetcher, &ModelPrefetcher::progress, [&](int numDone, int numTotal){
+        emit(progress(loadShapesPercent * (double(numDone) / numTotal)));
+    });
+    prefetcher.prefetch(catModels, true);
 
 	// Check for stored correspondence results on disk
 	QString matching_file = document->datasetPath + "/" + sourceName + "_matches.txt";
@@ -140,6 +238,8 @@ void DocumentAnalyzeWorker::processShapeDataset()
 	if (QFileInfo(matching_file).exists()){
 		document->loadDatasetCorr(matching_file);
 		emit(progress(100));
+		prefetcher.waitForDone();
+		unpinModels(catModels);
 		emit(finished());
 		return;
 	}
@@ -147,91 +247,105 @@ void DocumentAnalyzeWorker::processShapeDataset()
     // Compute correspondence with respect to active shape
     int k = 4; // search parameter
 
+    QVariantMap options = CorrespondenceEngine::defaultOptions(k);
+    //options["align"].setValue(true);
+    //options["isAllowCutsJoins"].setValue(true);
+    //options["isIgnoreSymmetryGroups"].setValue(true);
+    //options["isOutputMatching"].setValue(true);
+
     auto cachedShapeA = document->getModel(sourceName);
+
+    // Previously computed pairs of this source
+    PairwiseStore store(document->datasetPath + "/corr/" + sourceName + "_pairs.txt");
+    store.load();
+
+    QString optionsHash = PairwiseStore::optionsHash(options);
+    QString sourceHash = cachedShapeA ? PairwiseStore::shapeHash(cachedShapeA) : QString();
+
+    QVector<CorrespondenceEngine::PairJob> jobs, storedJobs;
+    QStringList jobKeys;
+    QSet<QString> liveKeys;
     for(int i = 0; i < catModels.size(); i++)
     {
         QString targetName = catModels.at(i);
 
         if(sourceName == targetName) continue;
 
-        emit(progressText(QString("Processing: %1").arg(targetName)));
-
-        auto cachedShapeB = document->cacheModel(targetName);
-
-        QString sourceShape = "CACHED_" + sourceName;
-        QString targetShape = "CACHED_" + targetName;
-
-        QVariantMap options;
-        options["roundtrip"].setValue(true);
-        options["k"].setValue( k );
-        options["isQuietMode"].setValue(true);
-        options["isManyTypesJobs"].setValue(true);
-        //options["align"].setValue(true);
-        //options["isAllowCutsJoins"].setValue(true);
-        //options["isIgnoreSymmetryGroups"].setValue(true);
-        //options["isOutputMatching"].setValue(true);
-
-        int numJobs = 0;
-
-		QVector< QVector<QVariantMap> > reports;
-
-		// Perform correspondence search
-		{
-			// First pass source to target
-			{
-				auto bp = QSharedPointer<BatchProcess>(new BatchProcess(sourceShape, targetShape, options));
-				bp->cachedShapeA = QSharedPointer<Structure::ShapeGraph>(document->cloneAsShapeGraph(cachedShapeA));
-				bp->cachedShapeB = QSharedPointer<Structure::ShapeGraph>(document->cloneAsShapeGraph(cachedShapeB));
-				bp->jobUID = numJobs++;
-				bp->run();
-				reports << bp->jobReports;
-			}
-
-			// Second pass target to source
-			if (options["roundtrip"].toBool())
-			{
-				auto bp2 = QSharedPointer<BatchProcess>(new BatchProcess(targetShape, sourceShape, options));
-				bp2->cachedShapeA = QSharedPointer<Structure::ShapeGraph>(document->cloneAsShapeGraph(cachedShapeB));
-				bp2->cachedShapeB = QSharedPointer<Structure::ShapeGraph>(document->cloneAsShapeGraph(cachedShapeA));
-				bp2->jobUID = numJobs++;
-				bp2->run();
-				reports << bp2->jobReports;
-			}
-		}
-
-        // Look at reports
-        double minEnergy = 1.0;
-        int totalTime = 0;
-        QVariantMap minJob;
-		for (auto & reportVec : reports){
-			for (auto & report : reportVec){
-				totalTime += report["search_time"].toInt();
-                double c = report["min_cost"].toDouble();
-                if (c < minEnergy){
-                    minEnergy = c;
-                    minJob = report;
-                }
-            }
+        CorrespondenceEngine::PairJob job;
+        job.source = sourceName;
+        job.target = targetName;
+        job.sourceModel = cachedShapeA;
+        job.targetModel = prefetcher.wait(targetName);
+        job.options = options;
+        if(job.sourceModel == nullptr || job.targetModel == nullptr) continue;
+
+        QString key = PairwiseStore::pairKey(sourceHash, PairwiseStore::shapeHash(job.targetModel), optionsHash);
+        liveKeys << key;
+        if(store.contains(key)){
+            job.result = store.get(key);
+            job.isDone = true;
+            storedJobs << job;
+            continue;
         }
 
-        //std::cout << "\nJobs computed: " << numJobs << "\n";
-        //std::cout << minEnergy << " - " << qPrintable(minJob["img_file"].toString());
+        jobs << job;
+        jobKeys << key;
+    }
 
-		auto firstReport = reports.front().front();
+    // Results of changed shapes or options are dropped once they outnumber current ones
+    if(store.compact(liveKeys)) emit(progressText(QString("Compacted %1").arg(store.fileName())));
+
+    prefetcher.waitForDone();
+    emit(progressText(prefetcher.throughputText()));
+
+    if(store.size()) emit(progressText(QString("Resuming: %1 pairs left to compute").arg(jobs.size())));
+
+    CorrespondenceEngine engine(numWorkers, &cancelRequested);
+
+    connect(&engine, &CorrespondenceEngine::jobStarted, [&](int jobIndex){
+        emit(progressText(QString("Processing: %1").arg(jobs.at(jobIndex).target)));
+    });
+    connect(&engine, &CorrespondenceEngine::jobFinished, [&](int jobIndex){
+        auto & job = jobs.at(jobIndex);
+        store.insert(jobKeys.at(jobIndex), job.source, job.target, job.result);
+    });
+    connect(&engine, &CorrespondenceEngine::progress, [&](int numDone, int numJobs){
+        emit(progress(loadShapesPercent + (computeCorrespodPercent * (double(numDone) / numJobs))));
+    });
+
+    engine.run(jobs);
+    emit(progressText(engine.statsText()));
+
+    // Partial results stay in the store only, the next run picks up from there
+    if(isCancelled()){
+        int numDone = 0;
+        for(auto & job : jobs) if(job.isDone) numDone++;
+        emit(progressText(QString("Cancelled: %1 of %2 pairs computed").arg(numDone).arg(jobs.size())));
+        unpinModels(catModels);
+        emit(cancelled());
+        return;
+    }
 
-		for (auto p : minJob["matching_pairs"].value< QVector< QPair<QString, QString> > >())
-		{
-			// When best result was from the other way
-			if (minJob["job_uid"].toInt() != firstReport["job_uid"].toInt()) std::swap(p.first, p.second);
+    jobs << storedJobs;
 
-            document->datasetCorr[sourceName][p.first][targetName].push_back(p.second);
-		}
+    for(auto & job : jobs)
+    {
+        auto & minJob = job.result;
 
-        emit(progress(loadShapesPercent + (computeCorrespodPercent * (double(i) / (catModels.size()-1)))));
+        for (auto p : minJob["matching_pairs"].value< QVector< QPair<QString, QString> > >())
+        {
+            // When best result was from the other way
+            if (minJob["isReversed"].toBool()) std::swap(p.first, p.second);
+
+            document->datasetCorr.add(sourceName, p.first, job.target, p.second);
+        }
     }
 
+    document->datasetCorr.build();
+
 	// Save results to disk
 	document->saveDatasetCorr(matching_file);
 
+    unpinModels(catModels);
     emit(finished());
 }
@@ -1,18 +1,53 @@
 #pragma once
+#include <QAtomicInt>
 #include "Document.h"
 
 class DocumentAnalyzeWorker : public QObject{
     Q_OBJECT
 public:
-    DocumentAnalyzeWorker(Document * d) : document(d){}
+    DocumentAnalyzeWorker(Document * d, int numWorkers = -1) : document(d), numWorkers(numWorkers),
+        shardIndex(0), numShards(1), isShardByHash(false), isMergeShards(false), cancelRequested(0){}
     Document * document;
 
+    // Number of concurrent correspondence jobs, all cores when not positive
+    int numWorkers;
+
+    // All-pairs matching split over processes, this worker computes shard shardIndex of numShards
+    // into its own store file. Pairs are split in contiguous index ranges or by a hash of their names.
+    int shardIndex, numShards;
+    bool isShardByHash;
+
+    // Collect the shard stores and write the canonical files instead of computing
+    bool isMergeShards;
+
+    bool isInShard(int pairIndex, int numPairs, QString source, QString target);
+    static QString shardFileName(QString storeFile, int shardIndex, int numShards);
+
+    bool isCancelled(){ return cancelRequested.load(); }
+
+    // Set when the run could not produce its results, e.g. a merge with missing shards
+    QString failureText;
+    bool isFailed(){ return !failureText.isEmpty(); }
+
+protected:
+    // Completed pairs are kept in the store, a cancelled or crashed run resumes from there
+    QAtomicInt cancelRequested;
+
+    void unpinModels(QStringList names){ for(auto name : names) document->unpinModel(name); }
+
 public slots:
     void processAllPairWise();
     void processShapeDataset();
 
+    // Safe to call from any thread while processing, needs a direct connection
+    void cancel(){ cancelRequested.store(1); }
+
 signals:
     void finished();
+    // Sent instead of finished() when cancelled, the dataset is left partially analyzed
+    void cancelled();
+    // Sent instead of finished() when the run failed, see failureText
+    void failed(QString);
     void progress(int);
     void progressText(QString);
 };
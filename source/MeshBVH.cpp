@@ -0,0 +1,284 @@
+#include "MeshBVH.h"
+
+#include <algorithm>
+#include <limits>
+
+#include "ShapeGraph.h"
+#include "Model.h"
+
+using namespace opengp;
+
+MeshBVH::MeshBVH()
+{
+
+}
+
+bool MeshBVH::collectPoints(Structure::ShapeGraph * shape, bool isRefit)
+{
+    int partIndex = 0;
+    size_t numPoints = 0;
+
+    for(auto n : shape->nodes)
+    {
+        auto mesh = shape->getMesh(n->id);
+        if(mesh == nullptr) continue;
+
+        if(isRefit){
+            if(partIndex >= parts.size() || parts[partIndex] != n->id) return false;
+            if(partFirstVertex[partIndex] != int(numPoints)) return false;
+
+            // A remeshed part keeps its old triangles otherwise
+            if(partMesh[partIndex] != mesh || partNumFaces[partIndex] != int(mesh->n_faces())) return false;
+        }else{
+            parts << n->id;
+            partFirstVertex.push_back(int(points.size()));
+            partMesh.push_back(mesh);
+            partNumFaces.push_back(int(mesh->n_faces()));
+        }
+
+        // Duplicated parts share a mesh and are placed by their instance transform
+        Eigen::Matrix4d T = Eigen::Matrix4d::Identity();
+        bool isInstance = Model::isInstance(n);
+        if(isInstance){
+            auto transform = Model::instanceTransform(n);
+            for(int i = 0; i < 4; i++)
+                for(int j = 0; j < 4; j++) T(i,j) = transform(i,j);
+        }
+
+        auto coords = mesh->vertex_coordinates();
+        for(auto v : mesh->vertices())
+        {
+            Eigen::Vector3d p = coords[v];
+            if(isInstance) p = (T * Eigen::Vector4d(p[0], p[1], p[2], 1)).head<3>();
+
+            if(isRefit){
+                if(numPoints >= points.size()) return false;
+                points[numPoints] = p;
+            }else{
+                points.push_back(p);
+            }
+            numPoints++;
+        }
+
+        // Faces are fanned into triangles
+        if(!isRefit)
+        {
+            int offset = partFirstVertex.back();
+            for(auto f : mesh->faces())
+            {
+                std::vector<int> fv;
+                for(auto v : mesh->vertices(f)) fv.push_back(offset + v.idx());
+
+                for(size_t i = 2; i < fv.size(); i++){
+                    Triangle tri;
+                    tri.v[0] = fv[0]; tri.v[1] = fv[i-1]; tri.v[2] = fv[i];
+                    tri.part = partIndex;
+                    tri.face = f.idx();
+                    triangles.push_back(tri);
+                }
+            }
+        }
+
+        partIndex++;
+    }
+
+    return !isRefit || (partIndex == parts.size() && numPoints == points.size());
+}
+
+void MeshBVH::build(Structure::ShapeGraph * shape)
+{
+    parts.clear();
+    points.clear();
+    triangles.clear();
+    nodes.clear();
+    partFirstVertex.clear();
+    partMesh.clear();
+    partNumFaces.clear();
+
+    collectPoints(shape, false);
+    if(triangles.empty()) return;
+
+    nodes.reserve(2 * triangles.size() / leafSize + 1);
+    buildNode(0, int(triangles.size()));
+}
+
+int MeshBVH::buildNode(int first, int count)
+{
+    int index = int(nodes.size());
+    nodes.push_back(Node());
+
+    Eigen::AlignedBox3d box, centroidBox;
+    for(int i = first; i < first + count; i++){
+        auto & tri = triangles[i];
+        Eigen::Vector3d c(0,0,0);
+        for(int j = 0; j < 3; j++){
+            box.extend(points[tri.v[j]]);
+            c += points[tri.v[j]];
+        }
+        centroidBox.extend(c / 3.0);
+    }
+
+    nodes[index].box = box;
+    nodes[index].first = first;
+    nodes[index].count = count;
+    nodes[index].right = -1;
+
+    if(count <= leafSize) return index;
+
+    // Median split along the longest extent of the centroids
+    int axis;
+    centroidBox.sizes().maxCoeff(&axis);
+    if(centroidBox.sizes()[axis] <= 0) return index;
+
+    auto centroid = [&](const Triangle & tri){
+        return points[tri.v[0]][axis] + points[tri.v[1]][axis] + points[tri.v[2]][axis];
+    };
+
+    int half = count / 2;
+    std::nth_element(triangles.begin() + first, triangles.begin() + first + half, triangles.begin() + first + count,
+                     [&](const Triangle & a, const Triangle & b){ return centroid(a) < centroid(b); });
+
+    nodes[index].count = 0;
+    buildNode(first, half);
+    int right = buildNode(first + half, count - half);
+    nodes[index].right = right;
+
+    return index;
+}
+
+bool MeshBVH::refit(Structure::ShapeGraph * shape)
+{
+    if(nodes.empty() || !collectPoints(shape, true)) return false;
+    refitNode(0);
+    return true;
+}
+
+void MeshBVH::refitNode(int index)
+{
+    auto & node = nodes[index];
+
+    if(node.right < 0){
+        Eigen::AlignedBox3d box;
+        for(int i = node.first; i < node.first + node.count; i++)
+            for(int j = 0; j < 3; j++) box.extend(points[triangles[i].v[j]]);
+        node.box = box;
+        return;
+    }
+
+    refitNode(index + 1);
+    refitNode(node.right);
+    node.box = nodes[index + 1].box.merged(nodes[node.right].box);
+}
+
+bool MeshBVH::intersectTriangle(const Triangle & tri, const Eigen::Vector3d & origin,
+                                const Eigen::Vector3d & direction, double & t) const
+{
+    const Eigen::Vector3d & p0 = points[tri.v[0]];
+    Eigen::Vector3d edge1 = points[tri.v[1]] - p0;
+    Eigen::Vector3d edge2 = points[tri.v[2]] - p0;
+    Eigen::Vector3d pvec = direction.cross(edge2);
+    double det = edge1.dot(pvec);
+    if (det == 0) return false;
+    double invDet = 1 / det;
+    Eigen::Vector3d tvec = origin - p0;
+    double u = tvec.dot(pvec) * invDet;
+    if (u < 0 || u > 1) return false;
+    Eigen::Vector3d qvec = tvec.cross(edge1);
+    double v = direction.dot(qvec) * invDet;
+    if (v < 0 || u + v > 1) return false;
+    t = edge2.dot(qvec) * invDet;
+    return t > 0;
+}
+
+bool MeshBVH::intersectBox(const Eigen::AlignedBox3d & box, const Eigen::Vector3d & origin,
+                           const Eigen::Vector3d & invDirection, double maxT, double & tEnter)
+{
+    double tmin = 0, tmax = maxT;
+    for(int i = 0; i < 3; i++)
+    {
+        double t1 = (box.min()[i] - origin[i]) * invDirection[i];
+        double t2 = (box.max()[i] - origin[i]) * invDirection[i];
+        if(t1 > t2) std::swap(t1, t2);
+        tmin = std::max(tmin, t1);
+        tmax = std::min(tmax, t2);
+        if(tmin > tmax) return false;
+    }
+    tEnter = tmin;
+    return true;
+}
+
+bool MeshBVH::intersect(const Eigen::Vector3d & origin, const Eigen::Vector3d & direction, Hit & hit) const
+{
+    if(nodes.empty()) return false;
+
+    Eigen::Vector3d invDirection(1.0 / direction[0], 1.0 / direction[1], 1.0 / direction[2]);
+
+    hit.t = std::numeric_limits<double>::max();
+    int hitTriangle = -1;
+
+    double tEnter;
+    if(!intersectBox(nodes[0].box, origin, invDirection, hit.t, tEnter)) return false;
+
+    int stack[64];
+    int stackSize = 0;
+    stack[stackSize++] = 0;
+
+    while(stackSize)
+    {
+        const Node & node = nodes[stack[--stackSize]];
+
+        if(node.right < 0)
+        {
+            for(int i = node.first; i < node.first + node.count; i++){
+                double t;
+                if(intersectTriangle(triangles[i], origin, direction, t) && t < hit.t){
+                    hit.t = t;
+                    hitTriangle = i;
+                }
+            }
+            continue;
+        }
+
+        // Visit the nearer child first
+        int left = int(&node - &nodes[0]) + 1, right = node.right;
+        double tLeft, tRight;
+        bool isLeft = intersectBox(nodes[left].box, origin, invDirection, hit.t, tLeft);
+        bool isRight = intersectBox(nodes[right].box, origin, invDirection, hit.t, tRight);
+
+        if(isLeft && isRight){
+            if(tLeft < tRight) std::swap(left, right);
+            stack[stackSize++] = left;
+            stack[stackSize++] = right;
+        }
+        else if(isLeft) stack[stackSize++] = left;
+        else if(isRight) stack[stackSize++] = right;
+    }
+
+    if(hitTriangle < 0) return false;
+
+    hit.part = triangles[hitTriangle].part;
+    hit.face = triangles[hitTriangle].face;
+    hit.point = origin + hit.t * direction;
+    return true;
+}
+
+bool MeshBVH::intersectBruteForce(const Eigen::Vector3d & origin, const Eigen::Vector3d & direction, Hit & hit) const
+{
+    hit.t = std::numeric_limits<double>::max();
+    int hitTriangle = -1;
+
+    for(size_t i = 0; i < triangles.size(); i++){
+        double t;
+        if(intersectTriangle(triangles[i], origin, direction, t) && t < hit.t){
+            hit.t = t;
+            hitTriangle = int(i);
+        }
+    }
+
+    if(hitTriangle < 0) return false;
+
+    hit.part = triangles[hitTriangle].part;
+    hit.face = triangles[hitTriangle].face;
+    hit.point = origin + hit.t * direction;
+    return true;
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <vector>
+#include <QStringList>
+#include <Eigen/Geometry>
+
+namespace Structure{ struct ShapeGraph; }
+namespace opengp{ namespace SurfaceMesh{ class SurfaceMeshModel; } }
+
+// Bounding volume hierarchy over the triangles of all parts of a shape, for ray picking.
+// Nodes are stored flat in depth first order, leaves hold a few triangles each.
+class MeshBVH
+{
+public:
+    MeshBVH();
+
+    // Collects every part triangle and builds the tree
+    void build(Structure::ShapeGraph * shape);
+
+    // Reads vertex positions again and updates the boxes, fails when a part's mesh or face count changed
+    bool refit(Structure::ShapeGraph * shape);
+
+    struct Hit{
+        double t;
+        int part;           // index into parts
+        int face;           // face index in the part's mesh
+        Eigen::Vector3d point;
+    };
+
+    // Closest hit in front of the origin
+    bool intersect(const Eigen::Vector3d & origin, const Eigen::Vector3d & direction, Hit & hit) const;
+
+    // Same query testing every triangle, for reference
+    bool intersectBruteForce(const Eigen::Vector3d & origin, const Eigen::Vector3d & direction, Hit & hit) const;
+
+    bool isEmpty() const { return nodes.empty(); }
+    int numTriangles() const { return int(triangles.size()); }
+
+    QStringList parts;
+
+protected:
+    struct Triangle{
+        int v[3];
+        int part, face;
+    };
+
+    struct Node{
+        Eigen::AlignedBox3d box;
+        int first, count;   // triangles of a leaf
+        int right;          // second child of an inner node, first child follows the node
+    };
+
+    std::vector<Eigen::Vector3d> points;
+    std::vector<Triangle> triangles;
+    std::vector<Node> nodes;
+    std::vector<int> partFirstVertex;
+    std::vector<opengp::SurfaceMesh::SurfaceMeshModel*> partMesh;
+    std::vector<int> partNumFaces;
+
+    static const int leafSize = 4;
+
+    int buildNode(int first, int count);
+    void refitNode(int index);
+    bool intersectTriangle(const Triangle & tri, const Eigen::Vector3d & origin,
+                           const Eigen::Vector3d & direction, double & t) const;
+    static bool intersectBox(const Eigen::AlignedBox3d & box, const Eigen::Vector3d & origin,
+                             const Eigen::Vector3d & invDirection, double maxT, double & tEnter);
+    bool collectPoints(Structure::ShapeGraph * shape, bool isRefit);
+};
@@ -0,0 +1,480 @@
+#include "MeshBuffers.h"
+#include "Viewer.h"
+
+#include <QColor>
+#include <QVector4D>
+#include <QOpenGLShaderProgram>
+#include <QOpenGLExtraFunctions>
+
+#include "ShapeGraph.h"
+
+using namespace opengp;
+
+MeshBuffers::MeshBuffers() : uploadedVersion(-1), vbo(QOpenGLBuffer::VertexBuffer),
+    ibo(QOpenGLBuffer::IndexBuffer), instanceVbo(QOpenGLBuffer::VertexBuffer)
+{
+
+}
+
+MeshBuffers::~MeshBuffers()
+{
+    clear();
+}
+
+void MeshBuffers::clear()
+{
+    // Buffers belong to the viewer's context
+    if(!viewer.isNull() && vao.isCreated()){
+        viewer->makeCurrent();
+        vao.destroy();
+        instanceVao.destroy();
+        vbo.destroy();
+        ibo.destroy();
+        instanceVbo.destroy();
+        viewer->doneCurrent();
+    }
+
+    parts.clear();
+    partOfMesh.clear();
+    levels.clear();
+    uploadedVersion = -1;
+}
+
+QString MeshBuffers::statsText() const
+{
+    return QString("parts %1 (%2 culled), triangles %3 (%4 culled, %5 simplified), %6 draws")
+            .arg(stats.parts).arg(stats.culledParts).arg(stats.triangles)
+            .arg(stats.culledTriangles).arg(stats.simplifiedTriangles).arg(stats.drawCalls);
+}
+
+double MeshBuffers::projectedPixels(const QMatrix4x4 & pvm, const QVector3D & bmin, const QVector3D & bmax, int width, int height)
+{
+    // Corners on the outer side of each clip plane
+    int outside[6] = {0, 0, 0, 0, 0, 0};
+    bool isBehind = false;
+    double minX = 1e10, minY = 1e10, maxX = -1e10, maxY = -1e10;
+
+    for(int i = 0; i < 8; i++)
+    {
+        QVector3D c((i & 1) ? bmax.x() : bmin.x(), (i & 2) ? bmax.y() : bmin.y(), (i & 4) ? bmax.z() : bmin.z());
+        QVector4D q = pvm * QVector4D(c, 1.0);
+
+        if(q.x() < -q.w()) outside[0]++;
+        if(q.x() >  q.w()) outside[1]++;
+        if(q.y() < -q.w()) outside[2]++;
+        if(q.y() >  q.w()) outside[3]++;
+        if(q.z() < -q.w()) outside[4]++;
+        if(q.z() >  q.w()) outside[5]++;
+
+        if(q.w() <= 0){ isBehind = true; continue; }
+        minX = qMin(minX, double(q.x() / q.w())); maxX = qMax(maxX, double(q.x() / q.w()));
+        minY = qMin(minY, double(q.y() / q.w())); maxY = qMax(maxY, double(q.y() / q.w()));
+    }
+
+    for(int k = 0; k < 6; k++) if(outside[k] == 8) return -1;
+
+    // Crossing the eye plane, assume it fills the view
+    if(isBehind) return qMax(width, height);
+
+    return qMax((maxX - minX) * 0.5 * width, (maxY - minY) * 0.5 * height);
+}
+
+int MeshBuffers::levelFor(Viewer * glwidget, const Part & part, const QMatrix4x4 & transform) const
+{
+    double pixels = projectedPixels(glwidget->pvm * transform, part.bmin, part.bmax, glwidget->width(), glwidget->height());
+    if(pixels < 0) return -1;
+    return MeshLOD::levelFor(pixels);
+}
+
+static SurfaceMeshModel * partMesh(const RenderState & state)
+{
+    if(state.mesh == nullptr || state.mesh->n_faces() < 1) return nullptr;
+    return state.mesh;
+}
+
+QVector<MeshBuffers::Part> MeshBuffers::layout(const QVector<RenderState> & states)
+{
+    QVector<Part> result;
+    QVector<SurfaceMeshModel*> instanced;
+
+    for(int si = 0; si < states.size(); si++)
+    {
+        auto mesh = partMesh(states[si]);
+        if(mesh == nullptr) continue;
+
+        if(states[si].isInstance){
+            instanced << mesh;
+            continue;
+        }
+
+        Part part;
+        part.state = si;
+        part.mesh = mesh;
+        part.numVertices = int(mesh->n_vertices());
+        part.numFaces = int(mesh->n_faces());
+        result << part;
+    }
+
+    // Meshes of instances whose source part is gone or was edited
+    for(auto mesh : instanced)
+    {
+        bool isPacked = false;
+        for(auto & part : result) if(part.mesh == mesh){ isPacked = true; break; }
+        if(isPacked) continue;
+
+        Part part;
+        part.state = -1;
+        part.mesh = mesh;
+        part.numVertices = int(mesh->n_vertices());
+        part.numFaces = int(mesh->n_faces());
+        result << part;
+    }
+
+    return result;
+}
+
+bool MeshBuffers::isStale(const QVector<RenderState> & states, int geometryVersion)
+{
+    if(!vao.isCreated() || uploadedVersion != geometryVersion) return true;
+
+    // Same parts with the same meshes, in the same order
+    auto wanted = layout(states);
+    if(wanted.size() != parts.size()) return true;
+
+    for(int i = 0; i < wanted.size(); i++){
+        if(wanted[i].state != parts[i].state || wanted[i].mesh != parts[i].mesh
+                || wanted[i].numVertices != parts[i].numVertices || wanted[i].numFaces != parts[i].numFaces)
+            return true;
+    }
+
+    return false;
+}
+
+void MeshBuffers::packVertices(SurfaceMeshModel * mesh, QVector<GLfloat> & vertices, Part & part)
+{
+    Eigen::AlignedBox3d box;
+    auto mesh_points = mesh->vertex_coordinates();
+    auto mesh_normals = mesh->vertex_normals();
+    for(auto v : mesh->vertices()){
+        for(int i = 0; i < 3; i++) vertices << mesh_points[v][i];
+        for(int i = 0; i < 3; i++) vertices << mesh_normals[v][i];
+        box.extend(mesh_points[v]);
+    }
+    part.bmin = QVector3D(box.min()[0], box.min()[1], box.min()[2]);
+    part.bmax = QVector3D(box.max()[0], box.max()[1], box.max()[2]);
+}
+
+void MeshBuffers::updateMovedParts(const QHash<SurfaceMeshModel*, int> & meshVersions)
+{
+    QVector<GLfloat> vertices;
+    bool isBound = false;
+
+    for(auto & part : parts)
+    {
+        int version = meshVersions.value(part.mesh);
+        if(version == part.version) continue;
+
+        vertices.resize(0);
+        vertices.reserve(part.numVertices * 6);
+        packVertices(part.mesh, vertices, part);
+        part.version = version;
+
+        if(!isBound){ vbo.bind(); isBound = true; }
+        vbo.write(part.firstVertex * 6 * sizeof(GLfloat), vertices.constData(), vertices.size() * sizeof(GLfloat));
+    }
+
+    if(isBound) vbo.release();
+}
+
+void MeshBuffers::upload(Viewer * glwidget, const QVector<RenderState> & states, const QHash<SurfaceMeshModel*, int> & meshVersions)
+{
+    // Position, vertex normal, and part index per mesh vertex
+    QVector<GLfloat> vertices;
+    QVector<GLint> partIndex;
+    QVector<GLuint> indices;
+
+    QVector<GLuint> vertexOffset;
+    std::vector<GLuint> fv;
+
+    parts = layout(states);
+    partOfMesh.clear();
+
+    for(int pi = 0; pi < parts.size(); pi++)
+    {
+        auto & part = parts[pi];
+        auto mesh = part.mesh;
+
+        part.firstIndex[0] = indices.size();
+        partOfMesh[mesh] = pi;
+
+        GLuint offset = partIndex.size();
+        vertexOffset << offset;
+        part.firstVertex = int(offset);
+        part.version = meshVersions.value(mesh);
+
+        int numFloats = vertices.size();
+        packVertices(mesh, vertices, part);
+        partIndex.insert(partIndex.end(), (vertices.size() - numFloats) / 6, pi);
+
+        // Faces are fanned into triangles
+        for(auto f : mesh->faces()){
+            fv.clear();
+            for(auto v : mesh->vertices(f)) fv.push_back(offset + v.idx());
+            for(size_t i = 2; i < fv.size(); i++) indices << fv[0] << fv[i-1] << fv[i];
+        }
+
+        part.numIndices[0] = indices.size() - part.firstIndex[0];
+    }
+
+    // Simplified levels follow all full meshes, so runs of full parts stay contiguous
+    QHash<SurfaceMeshModel*, Levels> usedLevels;
+    for(int level = 1; level < MeshLOD::numLevels; level++)
+    {
+        for(int pi = 0; pi < parts.size(); pi++)
+        {
+            auto & part = parts[pi];
+            auto mesh = part.mesh;
+
+            // Clustering is kept while dragging, which moves vertices but keeps the counts
+            if(!usedLevels.contains(mesh)){
+                auto cached = levels.value(mesh);
+                if(cached.numVertices != int(mesh->n_vertices()) || cached.numFaces != int(mesh->n_faces())){
+                    cached.numVertices = int(mesh->n_vertices());
+                    cached.numFaces = int(mesh->n_faces());
+                    for(int l = 1; l < MeshLOD::numLevels; l++)
+                        cached.triangles[l] = MeshLOD::clusterTriangles(mesh, MeshLOD::levelCells[l]);
+                }
+                usedLevels[mesh] = cached;
+            }
+
+            // A level that does not halve the previous one reuses it
+            auto & triangles = usedLevels[mesh].triangles[level];
+            if(triangles.empty() || int(triangles.size()) * 2 > part.numIndices[level-1]){
+                part.firstIndex[level] = part.firstIndex[level-1];
+                part.numIndices[level] = part.numIndices[level-1];
+                continue;
+            }
+
+            part.firstIndex[level] = indices.size();
+            for(int v : triangles) indices << vertexOffset[pi] + v;
+            part.numIndices[level] = int(triangles.size());
+        }
+    }
+    levels = usedLevels;
+
+    if(!vao.isCreated()) vao.create();
+    vao.bind();
+
+    if(!vbo.isCreated()){
+        vbo.setUsagePattern(QOpenGLBuffer::StaticDraw);
+        vbo.create();
+    }
+    if(!ibo.isCreated()){
+        ibo.setUsagePattern(QOpenGLBuffer::StaticDraw);
+        ibo.create();
+    }
+
+    // Part indices follow the interleaved positions and normals in the same buffer
+    int vertexBytes = vertices.size() * sizeof(GLfloat);
+    vbo.bind();
+    vbo.allocate(vertexBytes + partIndex.size() * sizeof(GLint));
+    vbo.write(0, vertices.constData(), vertexBytes);
+    vbo.write(vertexBytes, partIndex.constData(), partIndex.size() * sizeof(GLint));
+
+    // Same locations as the "meshBatch" shader layout
+    glwidget->glEnableVertexAttribArray(0);
+    glwidget->glEnableVertexAttribArray(1);
+    glwidget->glEnableVertexAttribArray(2);
+    glwidget->glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(GLfloat), (const void*)0);
+    glwidget->glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(GLfloat), (const void*)(3 * sizeof(GLfloat)));
+    glwidget->glVertexAttribIPointer(2, 1, GL_INT, 0, (const void*)(size_t)vertexBytes);
+
+    ibo.bind();
+    ibo.allocate(indices.constData(), indices.size() * sizeof(GLuint));
+
+    vao.release();
+    vbo.release();
+    ibo.release();
+}
+
+void MeshBuffers::draw(Viewer * glwidget, QOpenGLShaderProgram & program, const QVector<RenderState> & states, int geometryVersion,
+                       const QHash<SurfaceMeshModel*, int> & meshVersions)
+{
+    viewer = glwidget;
+
+    // Layout changes repack everything, moved parts rewrite their own vertices
+    if(isStale(states, geometryVersion)){
+        upload(glwidget, states, meshVersions);
+        uploadedVersion = geometryVersion;
+    }
+    else{
+        updateMovedParts(meshVersions);
+    }
+
+    stats = Stats();
+    if(parts.empty()) return;
+
+    int partBaseLocation = program.uniformLocation("partBase");
+    int partColorLocation = program.uniformLocation("partColor");
+    program.setUniformValue(program.uniformLocation("isInstanced"), 0);
+
+    vao.bind();
+
+    // Parts are contiguous in the index buffer, one draw per block of parts
+    for(int first = 0; first < parts.size(); first += maxPartsPerDraw)
+    {
+        int count = qMin(maxPartsPerDraw, parts.size() - first);
+
+        // Color, and in w: smooth shading 1, flat 0, hidden -1
+        QVector<QVector4D> colors;
+
+        // Index ranges of visible parts at their level, adjacent ones merged
+        QVector<GLsizei> counts;
+        QVector<const GLvoid*> offsets;
+        int runEnd = -1;
+
+        for(int i = first; i < first + count; i++)
+        {
+            auto & part = parts[i];
+            if(part.state < 0 || states[part.state].isHidden){
+                colors << QVector4D(0, 0, 0, -1);
+                continue;
+            }
+            colors << states[part.state].partColor();
+
+            stats.parts++;
+            int level = levelFor(glwidget, part, QMatrix4x4());
+            if(level < 0){
+                stats.culledParts++;
+                stats.culledTriangles += part.numIndices[0] / 3;
+                continue;
+            }
+
+            stats.triangles += part.numIndices[level] / 3;
+            stats.simplifiedTriangles += (part.numIndices[0] - part.numIndices[level]) / 3;
+
+            if(part.firstIndex[level] == runEnd)
+                counts.back() += part.numIndices[level];
+            else{
+                counts << part.numIndices[level];
+                offsets << (const GLvoid*)(part.firstIndex[level] * sizeof(GLuint));
+            }
+            runEnd = part.firstIndex[level] + part.numIndices[level];
+        }
+
+        if(counts.empty()) continue;
+
+        program.setUniformValue(partBaseLocation, first);
+        program.setUniformValueArray(partColorLocation, colors.constData(), colors.size());
+
+        glwidget->glMultiDrawElements(GL_TRIANGLES, counts.constData(), GL_UNSIGNED_INT, offsets.constData(), counts.size());
+        stats.drawCalls++;
+    }
+
+    vao.release();
+
+    drawInstances(glwidget, program, states);
+}
+
+void MeshBuffers::drawInstances(Viewer * glwidget, QOpenGLShaderProgram & program, const QVector<RenderState> & states)
+{
+    // Transform and color of each visible instance, grouped by shared mesh
+    const int stride = 16 + 4;
+    QMap<int, QVector<GLfloat> > groups;
+
+    // A group is drawn at the level of its largest instance on screen
+    QMap<int, int> groupLevel;
+
+    for(auto & state : states)
+    {
+        if(!state.isInstance || state.isHidden) continue;
+
+        auto mesh = partMesh(state);
+        if(mesh == nullptr || !partOfMesh.contains(mesh)) continue;
+
+        int pi = partOfMesh[mesh];
+        auto & transform = state.instanceTransform;
+
+        stats.parts++;
+        int level = levelFor(glwidget, parts[pi], transform);
+        if(level < 0){
+            stats.culledParts++;
+            stats.culledTriangles += parts[pi].numIndices[0] / 3;
+            continue;
+        }
+        groupLevel[pi] = qMin(groupLevel.value(pi, MeshLOD::numLevels - 1), level);
+
+        auto & data = groups[pi];
+        for(int i = 0; i < 16; i++) data << transform.constData()[i];
+
+        auto c = state.partColor();
+        data << c.x() << c.y() << c.z() << c.w();
+    }
+
+    if(groups.empty()) return;
+
+    auto f = glwidget->context()->extraFunctions();
+
+    // Shares the packed meshes, per instance attributes come from their own buffer
+    if(!instanceVao.isCreated())
+    {
+        instanceVao.create();
+        instanceVao.bind();
+
+        vbo.bind();
+        glwidget->glEnableVertexAttribArray(0);
+        glwidget->glEnableVertexAttribArray(1);
+        glwidget->glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(GLfloat), (const void*)0);
+        glwidget->glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(GLfloat), (const void*)(3 * sizeof(GLfloat)));
+        ibo.bind();
+
+        instanceVbo.setUsagePattern(QOpenGLBuffer::StreamDraw);
+        instanceVbo.create();
+        instanceVbo.bind();
+        for(int i = 3; i <= 7; i++){
+            glwidget->glEnableVertexAttribArray(i);
+            f->glVertexAttribDivisor(i, 1);
+        }
+
+        instanceVao.release();
+        vbo.release();
+        ibo.release();
+    }
+
+    QVector<GLfloat> data;
+    QVector< QPair<int,int> > ranges;
+    for(auto pi : groups.keys()){
+        ranges << qMakePair(pi, data.size() / stride);
+        data << groups[pi];
+    }
+
+    program.setUniformValue(program.uniformLocation("isInstanced"), 1);
+
+    instanceVao.bind();
+    instanceVbo.bind();
+    instanceVbo.allocate(data.constData(), data.size() * sizeof(GLfloat));
+
+    for(auto range : ranges)
+    {
+        auto & part = parts[range.first];
+        int level = groupLevel[range.first];
+        int numInstances = groups[range.first].size() / stride;
+        size_t offset = range.second * stride * sizeof(GLfloat);
+
+        stats.triangles += numInstances * part.numIndices[level] / 3;
+        stats.simplifiedTriangles += numInstances * (part.numIndices[0] - part.numIndices[level]) / 3;
+        stats.drawCalls++;
+
+        // Matrix columns at 3 to 6, color at 7
+        for(int i = 0; i < 5; i++)
+            glwidget->glVertexAttribPointer(3 + i, 4, GL_FLOAT, GL_FALSE, stride * sizeof(GLfloat), (const void*)(offset + 4 * i * sizeof(GLfloat)));
+
+        glwidget->glDrawElementsInstanced(GL_TRIANGLES, part.numIndices[level], GL_UNSIGNED_INT,
+                                          (const void*)(part.firstIndex[level] * sizeof(GLuint)), numInstances);
+    }
+
+    instanceVbo.release();
+    instanceVao.release();
+
+    program.setUniformValue(program.uniformLocation("isInstanced"), 0);
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <QVector>
+#include <QHash>
+#include <QPointer>
+#include <QString>
+#include <QVector3D>
+#include <QMatrix4x4>
+#include <vector>
+#include <QOpenGLBuffer>
+#include <QOpenGLVertexArrayObject>
+
+#include "MeshLOD.h"
+
+class Viewer;
+class QOpenGLShaderProgram;
+#include "RenderState.h"
+
+// GPU copy of all part meshes of a model packed into one indexed vertex buffer. Each vertex
+// carries its part index, part colors, visibility, and shading mode are uniforms, so a model
+// is drawn with one glDrawElements per maxPartsPerDraw parts. The buffers are uploaded again
+// only when parts are added, removed, or remeshed, or when the model geometry changes. Parts
+// whose mesh version changed alone, as when dragged, only have their vertex range rewritten.
+// Duplicated parts reuse the range of their shared mesh and are drawn instanced, with
+// their transforms and colors streamed per frame. Parts outside the view frustum are skipped
+// and small parts on screen are drawn from simplified index ranges of the same buffers.
+class MeshBuffers
+{
+public:
+    MeshBuffers();
+    ~MeshBuffers();
+
+    // Uniform arrays of the "meshBatch" shader
+    static const int maxPartsPerDraw = 192;
+
+    // Draws with the bound "meshBatch" shader
+    void draw(Viewer * glwidget, QOpenGLShaderProgram & program, const QVector<RenderState> & states, int geometryVersion,
+              const QHash<opengp::SurfaceMesh::SurfaceMeshModel*, int> & meshVersions);
+
+    void clear();
+
+    // Counts of the last draw, instances count as parts
+    struct Stats{
+        int parts, culledParts, drawCalls;
+        int triangles, culledTriangles, simplifiedTriangles;
+        Stats() : parts(0), culledParts(0), drawCalls(0), triangles(0), culledTriangles(0), simplifiedTriangles(0) {}
+    };
+    const Stats & lastStats() const { return stats; }
+    QString statsText() const;
+
+    // Pixels covered by the transformed box on screen, negative when outside the view frustum
+    static double projectedPixels(const QMatrix4x4 & pvm, const QVector3D & bmin, const QVector3D & bmax, int width, int height);
+
+protected:
+    struct Part{
+        int state;                  // -1 when only instances use the mesh
+        opengp::SurfaceMesh::SurfaceMeshModel * mesh;
+        int numVertices, numFaces;
+        int firstVertex, version;   // vertex range in the buffer and mesh version it holds
+        QVector3D bmin, bmax;
+        int firstIndex[MeshLOD::numLevels], numIndices[MeshLOD::numLevels];
+    };
+
+    // Simplified triangles of a mesh, reused while its vertex and face counts stay the same
+    struct Levels{
+        int numVertices, numFaces;
+        std::vector<int> triangles[MeshLOD::numLevels];
+        Levels() : numVertices(-1), numFaces(-1) {}
+    };
+
+    QVector<Part> parts;
+    QHash<opengp::SurfaceMesh::SurfaceMeshModel*, int> partOfMesh;
+    QHash<opengp::SurfaceMesh::SurfaceMeshModel*, Levels> levels;
+    Stats stats;
+    int uploadedVersion;
+
+    QOpenGLVertexArrayObject vao, instanceVao;
+    QOpenGLBuffer vbo, ibo, instanceVbo;
+    QPointer<Viewer> viewer;
+
+    // Meshes to pack, in drawing order
+    static QVector<Part> layout(const QVector<RenderState> & states);
+
+    bool isStale(const QVector<RenderState> & states, int geometryVersion);
+    void upload(Viewer * glwidget, const QVector<RenderState> & states, const QHash<opengp::SurfaceMesh::SurfaceMeshModel*, int> & meshVersions);
+    void updateMovedParts(const QHash<opengp::SurfaceMesh::SurfaceMeshModel*, int> & meshVersions);
+
+    // Interleaved position and normal per vertex of the mesh, extends the box
+    static void packVertices(opengp::SurfaceMesh::SurfaceMeshModel * mesh, QVector<GLfloat> & vertices, Part & part);
+    void drawInstances(Viewer * glwidget, QOpenGLShaderProgram & program, const QVector<RenderState> & states);
+
+    // Level for the part as placed by the transform, -1 when culled
+    int levelFor(Viewer * glwidget, const Part & part, const QMatrix4x4 & transform) const;
+};
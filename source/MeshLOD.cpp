@@ -0,0 +1,106 @@
+#include "MeshLOD.h"
+
+#include <unordered_map>
+#include <set>
+#include <array>
+#include <algorithm>
+#include <Eigen/Geometry>
+
+#include "ShapeGraph.h"
+
+using namespace opengp;
+
+int MeshLOD::levelFor(double pixels)
+{
+    if(pixels >= 256) return 0;
+    if(pixels >= 64) return 1;
+    return 2;
+}
+
+// Triangles over the given positions with clustered corners, collapsed and repeated ones removed
+static std::vector<int> cluster(const std::vector<Eigen::Vector3f> & positions, const std::vector<int> & triangles, int cells)
+{
+    if(cells <= 0 || positions.empty()) return triangles;
+
+    Eigen::AlignedBox3f box;
+    for(auto & p : positions) box.extend(p);
+    float cellSize = box.sizes().maxCoeff() / cells;
+    if(cellSize <= 0) return triangles;
+
+    // Representative vertex of each grid cell
+    std::unordered_map<qint64, int> cellVertex;
+    std::vector<int> representative(positions.size());
+    for(size_t i = 0; i < positions.size(); i++)
+    {
+        Eigen::Vector3i c = ((positions[i] - box.min()) / cellSize).cast<int>();
+        qint64 key = (qint64(c[0]) * (cells + 1) + c[1]) * (cells + 1) + c[2];
+        auto it = cellVertex.insert(std::make_pair(key, int(i))).first;
+        representative[i] = it->second;
+    }
+
+    std::vector<int> result;
+    std::set< std::array<int,3> > seen;
+
+    for(size_t t = 0; t + 2 < triangles.size(); t += 3)
+    {
+        int a = representative[triangles[t]], b = representative[triangles[t+1]], c = representative[triangles[t+2]];
+        if(a == b || b == c || a == c) continue;
+
+        // Same corners in any order count once
+        std::array<int,3> s = {{ a, b, c }};
+        std::sort(s.begin(), s.end());
+        if(!seen.insert(s).second) continue;
+
+        result.push_back(a); result.push_back(b); result.push_back(c);
+    }
+
+    return result;
+}
+
+std::vector<int> MeshLOD::clusterTriangles(SurfaceMeshModel * mesh, int cells)
+{
+    std::vector<Eigen::Vector3f> positions;
+    positions.reserve(mesh->n_vertices());
+    auto coords = mesh->vertex_coordinates();
+    for(auto v : mesh->vertices()) positions.push_back(coords[v].cast<float>());
+
+    // Faces are fanned into triangles
+    std::vector<int> triangles;
+    triangles.reserve(mesh->n_faces() * 3);
+    for(auto f : mesh->faces()){
+        std::vector<int> fv;
+        for(auto v : mesh->vertices(f)) fv.push_back(v.idx());
+        for(size_t i = 2; i < fv.size(); i++){
+            triangles.push_back(fv[0]); triangles.push_back(fv[i-1]); triangles.push_back(fv[i]);
+        }
+    }
+
+    return cluster(positions, triangles, cells);
+}
+
+void MeshLOD::simplifySoup(QVector<QVector3D> & points, QVector<QVector3D> & normals, int cells)
+{
+    if(cells <= 0 || points.size() < 3 || normals.size() != points.size()) return;
+
+    std::vector<Eigen::Vector3f> positions;
+    std::vector<int> triangles;
+    positions.reserve(points.size());
+    triangles.reserve(points.size());
+    for(int i = 0; i < points.size(); i++){
+        positions.push_back(Eigen::Vector3f(points[i].x(), points[i].y(), points[i].z()));
+        triangles.push_back(i);
+    }
+
+    auto simplified = cluster(positions, triangles, cells);
+
+    QVector<QVector3D> newPoints, newNormals;
+    newPoints.reserve(int(simplified.size()));
+    newNormals.reserve(int(simplified.size()));
+    for(int i : simplified){
+        newPoints << points[i];
+        newNormals << normals[i];
+    }
+
+    points = newPoints;
+    normals = newNormals;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <vector>
+#include <QVector>
+#include <QVector3D>
+
+namespace opengp{ namespace SurfaceMesh{ class SurfaceMeshModel; } }
+
+// Simplified levels of detail by vertex clustering: vertices are snapped to a grid with a given
+// number of cells along the longest side of the bounds, each cell keeps its first vertex, and
+// triangles that collapse are dropped. Simplified triangles index the original vertices.
+namespace MeshLOD{
+    // Grid cells of each level, level 0 is the full mesh
+    static const int numLevels = 3;
+    static const int levelCells[numLevels] = { 0, 32, 8 };
+
+    // Grid for meshes drawn into thumbnails of about 128 pixels
+    static const int thumbnailCells = 32;
+
+    // Level for a part covering this many pixels on screen
+    int levelFor(double pixels);
+
+    // Triangles of the simplified mesh as vertex indices, all fanned triangles when cells is zero
+    std::vector<int> clusterTriangles(opengp::SurfaceMesh::SurfaceMeshModel * mesh, int cells);
+
+    // Simplifies a triangle soup in place
+    void simplifySoup(QVector<QVector3D> & points, QVector<QVector3D> & normals, int cells);
+}
@@ -5,11 +5,17 @@
 using namespace opengp;
 
 #include "ModelMesher.h"
+#include "MeshBVH.h"
+#include "MeshBuffers.h"
+#include "SheetBuffers.h"
+#include "ModelHistory.h"
+
+#include <QSettings>
 
 Q_DECLARE_METATYPE(Array1D_Vector3);
 Q_DECLARE_METATYPE(Vector3);
 
-Model::Model(QObject *parent) : QObject(parent), Structure::ShapeGraph(""), activeNode(nullptr)
+Model::Model(QObject *parent) : QObject(parent), Structure::ShapeGraph(""), geometryVersion(0), activeNode(nullptr), isPickingDirty(true), isRenderStateDirty(true)
 {
 
 }
@@ -66,10 +72,34 @@ QVector<Structure::Node *> Model::makeDuplicates(Structure::Node *n, QString dup
     QVector<Structure::Node *> result;
 
     QStringList params = duplicationOp.split(",", QString::SkipEmptyParts);
-    if(params.empty() || n == nullptr) return result;
+    if(params.empty() || n == nullptr || getMesh(n->id) == nullptr) return result;
 
     QString op = params.takeFirst();
 
+    // Copies share the source mesh and only carry their placement
+    auto addInstance = [&](const Eigen::Affine3d & T, bool isMirrored){
+        auto cloneNode = n->clone();
+
+        // Apply transformation to node geometry
+        auto nodeGeometry = cloneNode->controlPoints();
+        for(auto & p : nodeGeometry) p = T * p;
+        cloneNode->setControlPoints(nodeGeometry);
+
+        // Duplicating a copy composes the placements
+        QMatrix4x4 transform;
+        for(int i = 0; i < 4; i++)
+            for(int j = 0; j < 4; j++) transform(i,j) = T.matrix()(i,j);
+        transform = transform * instanceTransform(n);
+
+        cloneNode->property["mesh"].setValue(n->property["mesh"].value< QSharedPointer<SurfaceMeshModel> >());
+        cloneNode->property["meshShared"].setValue(true);
+        cloneNode->property["instanceTransform"].setValue(transform);
+        cloneNode->property["isMirrored"].setValue(isMirrored != n->property.value("isMirrored").toBool());
+        n->property["meshShared"].setValue(true);
+
+        result.push_back(cloneNode);
+    };
+
     // Translational symmetry
     if(op == "dupT")
     {
@@ -83,28 +113,8 @@ QVector<Structure::Node *> Model::makeDuplicates(Structure::Node *n, QString dup
 
         for(int i = 1; i < count; i++)
         {
-            auto cloneNode = n->clone();
-
-            auto delta = Vector3(d) * i;
-
-            // Apply duplication operation
-            {
-                // Apply translation to node geometry
-                auto nodeGeometry = cloneNode->controlPoints();
-                for(auto & p : nodeGeometry) p += delta;
-                cloneNode->setControlPoints(nodeGeometry);
-
-                // Clone mesh and apply translation
-                auto mesh = getMesh(n->id);
-                auto cloneMesh = mesh->clone();
-                for(auto v : cloneMesh->vertices()) cloneMesh->vertex_coordinates()[v] += delta;
-                cloneMesh->update_face_normals();
-                cloneMesh->update_vertex_normals();
-                cloneMesh->updateBoundingBox();
-                cloneNode->property["mesh"].setValue(QSharedPointer<SurfaceMeshModel>(cloneMesh));
-            }
-
-            result.push_back(cloneNode);
+            Eigen::Affine3d T(Eigen::Translation3d(d * i));
+            addInstance(T, false);
         }
     }
 
@@ -117,38 +127,11 @@ QVector<Structure::Node *> Model::makeDuplicates(Structure::Node *n, QString dup
         double offset = params[3].toDouble();
         Vector3 planeNormal(x?1:0, y?1:0, z?1:0);
 
-        auto cloneNode = n->clone();
-
-        // Apply duplication operation
-        {
-            auto reflectPoint = [&](Vector3 V, Vector3 N, double offset){
-                return (-2*(V).dot(N)*N + V) + offset * N;
-            };
-
-            // Apply reflection to node
-            auto nodeGeometry = cloneNode->controlPoints();
-            for(auto & p : nodeGeometry) p = reflectPoint(p, planeNormal, offset);
-            cloneNode->setControlPoints(nodeGeometry);
-
-            // Clone a reflected mesh
-            auto mesh = getMesh(n->id);
-            auto cloneMesh = new SurfaceMeshModel(cloneNode->id + ".obj", cloneNode->id);
-            for(auto v : mesh->vertices()){
-                cloneMesh->add_vertex(reflectPoint(mesh->vertex_coordinates()[v], planeNormal, offset));
-            }
-            for(auto f : mesh->faces()){
-                std::vector<SurfaceMeshModel::Vertex> verts;
-                for(auto v : mesh->vertices(f)) verts.push_back(v);
-                std::reverse(verts.begin(), verts.end());
-                cloneMesh->add_face(verts);
-            }
-            cloneMesh->update_face_normals();
-            cloneMesh->update_vertex_normals();
-            cloneMesh->updateBoundingBox();
-            cloneNode->property["mesh"].setValue(QSharedPointer<SurfaceMeshModel>(cloneMesh));
-        }
-
-        result.push_back(cloneNode);
+        // p - 2 (p . N) N + offset N
+        Eigen::Affine3d T = Eigen::Affine3d::Identity();
+        T.linear() -= 2 * planeNormal * planeNormal.transpose();
+        T.translation() = offset * planeNormal;
+        addInstance(T, true);
     }
 
     // Rotational symmetry
@@ -164,42 +147,9 @@ QVector<Structure::Node *> Model::makeDuplicates(Structure::Node *n, QString dup
 
         for(int i = 1; i < count; i++)
         {
-            auto cloneNode = n->clone();
-
             double theta = ((2.0 * M_PI) / count) * i;
-
-            // Apply duplication operation
-            {
-                auto rotatePoint = [&](double theta, Vector3 v, Vector3 axis){
-                    //if(theta == 0) return v;
-                    //return (v * cos(theta) + axis.cross(v) * sin(theta) + axis * axis.dot(v) * (1 - cos(theta)));
-                    Eigen::AngleAxisd q(theta, axis);
-                    return q * v;
-                };
-
-                // Apply rotation to node geometry
-                auto nodeGeometry = cloneNode->controlPoints();
-                for(auto & p : nodeGeometry)
-                {
-                    p = rotatePoint(theta, p, axis);
-                }
-                cloneNode->setControlPoints(nodeGeometry);
-
-                // Clone mesh and apply translation
-                auto mesh = getMesh(n->id);
-                auto cloneMesh = mesh->clone();
-                for(auto v : cloneMesh->vertices())
-                {
-                    auto & p = cloneMesh->vertex_coordinates()[v];
-                    p = rotatePoint(theta, p, axis);
-                }
-                cloneMesh->update_face_normals();
-                cloneMesh->update_vertex_normals();
-                cloneMesh->updateBoundingBox();
-                cloneNode->property["mesh"].setValue(QSharedPointer<SurfaceMeshModel>(cloneMesh));
-            }
-
-            result.push_back(cloneNode);
+            Eigen::Affine3d T(Eigen::AngleAxisd(theta, axis));
+            addInstance(T, false);
         }
     }
 
@@ -232,7 +182,7 @@ void Model::duplicateActiveNodeViz(QString duplicationOp)
         // Distinguish new nodes
         auto color = n->vis_property["color"].value<QColor>();
         color = color.lighter(50);
-        n->vis_property["color"].setValue(color);
+        setVisProperty(n, "color", color);
 
         tempNodes.push_back(QSharedPointer<Structure::Node>(n));
     }
@@ -242,13 +192,15 @@ void Model::duplicateActiveNodeViz(QString duplicationOp)
         for(auto nid : g){
             if(nid == activeNode->id) continue;
 
-            getNode(nid)->vis_property["isHidden"].setValue(params.back() == "group");
+            setVisProperty(getNode(nid), "isHidden", params.back() == "group");
         }
     }
 }
 
 void Model::duplicateActiveNode(QString duplicationOp)
 {
+    invalidateGeometry();
+
     if(activeNode == nullptr) return;
 
     // Remove visualizations
@@ -287,6 +239,8 @@ void Model::duplicateActiveNode(QString duplicationOp)
 
 void Model::modifyLastAdded(QVector<QVector3D> &guidePoints)
 {
+    invalidateGeometry();
+
     if (guidePoints.size() < 2 || activeNode == nullptr) return;
 
     Structure::Curve* curve = dynamic_cast<Structure::Curve*>(activeNode);
@@ -346,6 +300,8 @@ void Model::modifyLastAdded(QVector<QVector3D> &guidePoints)
 
 void Model::generateSurface(double offset)
 {
+    invalidateGeometry();
+
     ModelMesher mesher(this);
 
     //mesher.generateOffsetSurface(offset);
@@ -354,11 +310,59 @@ void Model::generateSurface(double offset)
 
 void Model::placeOnGround()
 {
+    invalidateGeometry();
+
+    // Meshes are moved in place
+    detachMeshes();
+
     this->normalize();
     this->moveBottomCenterToOrigin();
 }
 
 void Model::selectPart(QVector3D orig, QVector3D dir)
+{
+    QString partID = pickPart(orig, dir);
+    activeNode = partID.isEmpty() ? nullptr : getNode(partID);
+}
+
+QString Model::pickPart(QVector3D orig, QVector3D dir)
+{
+    MeshBVH::Hit hit;
+    auto tree = pickingBVH();
+    if(!tree->intersect(Eigen::Vector3d(orig[0], orig[1], orig[2]), Eigen::Vector3d(dir[0], dir[1], dir[2]), hit))
+        return QString();
+    return tree->parts[hit.part];
+}
+
+MeshBVH * Model::pickingBVH()
+{
+    // Parts added, removed, or remeshed since the last build
+    bool isChanged = bvh.isNull();
+    if(!isChanged)
+    {
+        int numParts = 0;
+        for(auto n : nodes){
+            auto mesh = getMesh(n->id);
+            if(mesh == nullptr) continue;
+            if(numParts >= bvh->parts.size() || bvh->parts[numParts] != n->id){ isChanged = true; break; }
+            numParts++;
+        }
+        isChanged = isChanged || numParts != bvh->parts.size();
+    }
+
+    if(isChanged){
+        bvh = QSharedPointer<MeshBVH>(new MeshBVH());
+        bvh->build(this);
+    }
+    else if(isPickingDirty){
+        if(!bvh->refit(this)) bvh->build(this);
+    }
+
+    isPickingDirty = false;
+    return bvh.data();
+}
+
+QString Model::pickPartBruteForce(QVector3D orig, QVector3D dir)
 {
     QMap< double, QPair<int, Vector3> > isects;
     QMap< double, QString > isectNode;
@@ -374,11 +378,23 @@ void Model::selectPart(QVector3D orig, QVector3D dir)
 
         nodeMesh->updateBoundingBox();
 
+        // Duplicated parts share a mesh and are placed by their instance transform
+        Eigen::Matrix4d T = Eigen::Matrix4d::Identity();
+        bool isInstanced = isInstance(n);
+        if(isInstanced){
+            auto transform = instanceTransform(n);
+            for(int i = 0; i < 4; i++)
+                for(int j = 0; j < 4; j++) T(i,j) = transform(i,j);
+        }
+
         for(auto f : nodeMesh->faces())
         {
             std::vector<Vector3> tri;
-            for(auto v : nodeMesh->vertices(f))
-                tri.push_back( nodeMesh->vertex_coordinates()[v] );
+            for(auto v : nodeMesh->vertices(f)){
+                Vector3 p = nodeMesh->vertex_coordinates()[v];
+                if(isInstanced) p = (T * Eigen::Vector4d(p[0], p[1], p[2], 1)).head<3>();
+                tri.push_back( p );
+            }
 
             if( GeometryHelper::intersectRayTri(tri, origin, direction, ipoint) )
             {
@@ -390,15 +406,8 @@ void Model::selectPart(QVector3D orig, QVector3D dir)
     }
 
     // Only consider closest hit
-    if(isects.size())
-    {
-        double minDist = isects.keys().front();
-        activeNode = getNode(isectNode[minDist]);
-    }
-    else
-    {
-        activeNode = nullptr;
-    }
+    if(isects.size()) return isectNode[isects.keys().front()];
+    return QString();
 }
 
 void Model::deselectAll()
@@ -407,19 +416,80 @@ void Model::deselectAll()
     tempNodes.clear();
 }
 
+QString Model::renderStats() const
+{
+    return buffers.isNull() ? QString() : buffers->statsText();
+}
+
+void Model::setVisProperty(Structure::Node * n, QString key, QVariant value)
+{
+    if(n == nullptr) return;
+    n->vis_property[key] = value;
+    invalidateRenderState();
+}
+
+void Model::invalidatePartGeometry(Structure::Node * n)
+{
+    isPickingDirty = true;
+    auto mesh = n->property["mesh"].value< QSharedPointer<SurfaceMeshModel> >().data();
+    if(mesh != nullptr) meshVersions[mesh]++;
+}
+
+void Model::setColorFor(QString nodeID, QColor color)
+{
+    Structure::ShapeGraph::setColorFor(nodeID, color);
+    invalidateRenderState();
+}
+
+const QVector<RenderState> & Model::renderStates()
+{
+    // Nodes added or removed since the last build, compared by pointer
+    if(!isRenderStateDirty){
+        bool isSame = (renderStateList.size() == nodes.size() + tempNodes.size());
+        for(int i = 0; isSame && i < nodes.size(); i++)
+            isSame = (renderStateList[i].node == nodes[i]);
+        for(int i = 0; isSame && i < tempNodes.size(); i++)
+            isSame = (renderStateList[nodes.size() + i].node == tempNodes[i].data());
+        if(isSame) return renderStateList;
+    }
+
+    auto allNodes = nodes;
+    for(auto n : tempNodes) allNodes.push_back(n.data());
+
+    renderStateList.clear();
+    for(auto n : allNodes)
+    {
+        RenderState state;
+        state.node = n;
+        state.mesh = n->property["mesh"].value< QSharedPointer<SurfaceMeshModel> >().data();
+        state.color = n->vis_property["color"].value<QColor>();
+        state.isHidden = n->vis_property["isHidden"].toBool();
+        state.isSmoothShading = n->vis_property["isSmoothShading"].toBool();
+        state.isInstance = isInstance(n);
+        state.instanceTransform = instanceTransform(n);
+        renderStateList << state;
+    }
+
+    isRenderStateDirty = false;
+    return renderStateList;
+}
+
 void Model::draw(Viewer *glwidget)
 {
+    auto & states = renderStates();
+
     // Collect meshes
-    QVector<SurfaceMeshModel *> meshes;
-    for(auto n : nodes){
-        auto mesh = getMesh(n->id);
-        if(mesh != nullptr) { meshes << mesh; }
+    bool hasMeshes = false;
+    QVector<const RenderState*> sheets;
+    for(int ni = 0; ni < nodes.size(); ni++){
+        auto & state = states[ni];
+        if(state.mesh != nullptr) { hasMeshes = true; }
         else
         {
+            auto n = state.node;
             if(n->type() == Structure::CURVE)
             {
                 // Draw as a basic 3D curve
-                auto nodeColor = n->vis_property["color"].value<QColor>();
                 QVector<QVector3D> lines;
                 auto points = n->controlPoints();
                 for(int i = 1; i < points.size(); i++){
@@ -427,49 +497,16 @@ void Model::draw(Viewer *glwidget)
                     lines << QVector3D(points[i][0],points[i][1],points[i][2]);
                 }
                 glwidget->glLineWidth(6);
-                glwidget->drawLines(lines, nodeColor, glwidget->pvm, "lines");
+                glwidget->drawLines(lines, state.color, glwidget->pvm, "lines");
             }
 
+            // Tessellated from cached buffers below
             if(n->type() == Structure::SHEET)
-            {
-                auto & sheet = ((Structure::Sheet*) n)->surface;
-
-                // Build surface geometry if needed
-                if(sheet.quads.empty())
-                {
-                    double resolution = (sheet.mCtrlPoint.front().front()
-                                         - sheet.mCtrlPoint.back().back()).norm() * 0.1;
-                    sheet.generateSurfaceQuads( resolution );
-                }
-
-                // Draw surface as triangles
-                QVector<QVector3D> points, normals;
-                for(auto quad : sheet.quads){
-                    QVector<QVector3D> quad_points, quad_normals;
-
-                    for(int i = 0; i < 4; i++){
-                        quad_points << QVector3D(quad.p[i][0],quad.p[i][1],quad.p[i][2]);
-                        quad_normals << QVector3D(quad.n[i][0],quad.n[i][1],quad.n[i][2]);
-                    }
-
-                    // Add two triangles of the quad
-                    points<<quad_points[0]; normals<<quad_normals[0];
-                    points<<quad_points[1]; normals<<quad_normals[1];
-                    points<<quad_points[2]; normals<<quad_normals[2];
-
-                    points<<quad_points[0]; normals<<quad_normals[0];
-                    points<<quad_points[2]; normals<<quad_normals[2];
-                    points<<quad_points[3]; normals<<quad_normals[3];
-                }
-
-                auto nodeColor = n->vis_property["color"].value<QColor>();
-                glwidget->drawTriangles(nodeColor, points, normals, glwidget->pvm);
-                glwidget->drawPoints(points,nodeColor,glwidget->pvm);
-            }
+                sheets << &state;
         }
     }
 
-    if(meshes.empty()) return;
+    if(!hasMeshes && sheets.empty()) return;
 
     // Draw meshes:
     glwidget->glEnable(GL_DEPTH_TEST);
@@ -477,18 +514,9 @@ void Model::draw(Viewer *glwidget)
     glwidget->glCullFace(GL_BACK);
 
     // Activate shader
-    auto & program = *glwidget->shaders["mesh"];
+    auto & program = *glwidget->shaders["meshBatch"];
     program.bind();
 
-    // Attributes
-    int vertexLocation = program.attributeLocation("vertex");
-    int normalLocation = program.attributeLocation("normal");
-    int colorLocation = program.attributeLocation("color");
-
-    program.enableAttributeArray(vertexLocation);
-    program.enableAttributeArray(normalLocation);
-    program.enableAttributeArray(colorLocation);
-
     // Uniforms
     int matrixLocation = program.uniformLocation("matrix");
     int lightPosLocation = program.uniformLocation("lightPos");
@@ -500,68 +528,42 @@ void Model::draw(Viewer *glwidget)
     program.setUniformValue(viewPosLocation, glwidget->eyePos);
     program.setUniformValue(lightColorLocation, QVector3D(1,1,1));
 
-    // Add visualized nodes for duplication and such
-    auto allNodes = nodes;
-    for(auto n : tempNodes) allNodes.push_back(n.data());
-
-    // Draw parts as meshes
-    for(auto n : allNodes)
-    {
-        auto mesh = n->property["mesh"].value< QSharedPointer<SurfaceMeshModel> >().data();
-        if(mesh == nullptr || mesh->n_faces() < 1) continue;
-        if(n->vis_property["isHidden"].toBool()) continue;
+    // Draw all part meshes, with visualized nodes for duplication and such, from one shared indexed buffer
+    if(buffers.isNull()) buffers = QSharedPointer<MeshBuffers>(new MeshBuffers());
+    buffers->draw(glwidget, program, states, geometryVersion, meshVersions);
 
-        auto nodeColor = n->vis_property["color"].value<QColor>();
-        auto ncolor = Eigen::Vector3f(nodeColor.redF(), nodeColor.greenF(), nodeColor.blueF());
+    // Sheets without meshes
+    if(sheetBuffers.isNull()) sheetBuffers = QSharedPointer<SheetBuffers>(new SheetBuffers());
+    sheetBuffers->draw(glwidget, program, sheets);
 
-        bool isSmoothShading = n->vis_property["isSmoothShading"].toBool();
+    program.release();
 
-        // Pack geometry, normals, and colors
-        QVector<GLfloat> vertex, normal, color;
+    for(auto state : sheets)
+        glwidget->drawPoints(sheetBuffers->gridPoints((Structure::Sheet*) state->node), state->color, glwidget->pvm);
 
-        auto mesh_points = mesh->vertex_coordinates();
-        auto mesh_normals = mesh->vertex_normals();
-        auto mesh_fnormals = mesh->face_normals();
+    if(!hasMeshes) return;
 
-        int v_count = 0;
+    // Draw bounding box around active part
+    const RenderState * active = nullptr;
+    for(int ni = 0; ni < nodes.size(); ni++)
+        if(states[ni].node == activeNode && states[ni].mesh != nullptr) active = &states[ni];
 
-        // Pack mesh faces
-        for(auto f : mesh->faces()){
-            for(auto vf : mesh->vertices(f)){
-                for(int i = 0; i < 3; i++){
-                    // Coordinate
-                    vertex << mesh_points[vf][i];
-                    // Color
-                    color << ncolor[i];
-                    // Normal
-                    if (!isSmoothShading) normal << mesh_fnormals[f][i];
-                    else normal << mesh_normals[vf][i];
-                    v_count++;
-                }
+    if(active != nullptr)
+    {
+        Eigen::AlignedBox3d box = active->mesh->bbox();
+
+        // Copies are placed by their instance transform
+        if(active->isInstance){
+            auto transform = active->instanceTransform;
+            Eigen::AlignedBox3d placed;
+            for(int i = 0; i < 8; i++){
+                auto c = box.corner(Eigen::AlignedBox3d::CornerType(i));
+                auto q = transform.map(QVector3D(c[0], c[1], c[2]));
+                placed.extend(Eigen::Vector3d(q[0], q[1], q[2]));
             }
+            box = placed;
         }
 
-        // Shader data
-        program.setAttributeArray(vertexLocation, &vertex[0], 3);
-        program.setAttributeArray(normalLocation, &normal[0], 3);
-        program.setAttributeArray(colorLocation, &color[0], 3);
-
-        // Draw
-        glwidget->glDrawArrays(GL_TRIANGLES, 0, mesh->n_faces() * 3);
-    }
-
-    program.disableAttributeArray(vertexLocation);
-    program.disableAttributeArray(normalLocation);
-    program.disableAttributeArray(colorLocation);
-
-    program.release();
-
-    // Draw bounding box around active part
-    if(activeNode != nullptr && getMesh(activeNode->id) != nullptr)
-    {
-        auto mesh = getMesh(activeNode->id);
-        auto box = mesh->bbox();
-
         QVector<Eigen::Vector3d> corners;
         corners<<box.corner(Eigen::AlignedBox3d::BottomLeftFloor);
         corners<<box.corner(Eigen::AlignedBox3d::BottomRightFloor);
@@ -619,8 +621,17 @@ void Model::draw(Viewer *glwidget)
     }
 }
 
+// Contiguous Vector3 values of a mesh property viewed as a 3 x n matrix
+template<typename Property>
+static Eigen::Map<Eigen::Matrix3Xd> coordinateMatrix(Property property, size_t n)
+{
+    return Eigen::Map<Eigen::Matrix3Xd>(n ? (double*)property.data() : nullptr, 3, Eigen::DenseIndex(n));
+}
+
 void Model::storeActiveNodeGeometry()
 {
+    restGeometry.clear();
+
     if (activeNode == nullptr) return;
 
     QSet<Structure::Node*> nodes;
@@ -635,20 +646,34 @@ void Model::storeActiveNodeGeometry()
 
     for(auto n : nodes)
     {
-        // Store initial node and mesh geometries
-        n->property["restNodeGeometry"].setValue(n->controlPoints());
-        n->property["restNodeCentroid"].setValue(n->center());
-        auto mesh = getMesh(n->id);
-        Array1D_Vector3 meshPoints;
-        for (auto v : mesh->vertices()) meshPoints.push_back(mesh->vertex_coordinates()[v]);
-        n->property["restMeshGeometry"].setValue(meshPoints);
+        if(isInstance(n)){
+            expandInstance(n);
+            invalidateGeometry();
+        }
+
+        // Store initial node and mesh geometries, relative to the node centroid
+        auto & rest = restGeometry[n];
+        rest.centroid = n->center();
+        rest.nodePoints = n->controlPoints();
+
+        // Copy a shared mesh now rather than on the first drag
+        auto mesh = detachMesh(n);
+        mesh->update_face_normals();
+        mesh->update_vertex_normals();
+
+        rest.meshPoints = coordinateMatrix(mesh->vertex_coordinates(), mesh->n_vertices()).colwise() - rest.centroid;
+        rest.meshNormals = coordinateMatrix(mesh->vertex_normals(), mesh->n_vertices());
+        rest.faceNormals = coordinateMatrix(mesh->face_normals(), mesh->n_faces());
     }
+
+    // Detached meshes are new objects
+    invalidateRenderState();
 }
 
 void Model::transformActiveNodeGeometry(QMatrix4x4 transform)
 {
     if (activeNode == nullptr) return;
-    if (!activeNode->property.contains("restNodeGeometry")) return;
+    if (!restGeometry.contains(activeNode)) return;
 
     QSet<Structure::Node*> nodes;
     nodes << activeNode;
@@ -660,30 +685,43 @@ void Model::transformActiveNodeGeometry(QMatrix4x4 transform)
         }
     }
 
+    // Affine part of the transform, normals use the inverse transpose of the linear part
+    Eigen::Matrix4d T;
+    for(int i = 0; i < 4; i++)
+        for(int j = 0; j < 4; j++) T(i,j) = transform(i,j);
+    Eigen::Matrix3d linear = T.topLeftCorner<3,3>();
+    Eigen::Matrix3d normalMatrix = linear.inverse().transpose();
+
     for(auto n : nodes)
     {
-        auto n_centroid = n->property["restNodeCentroid"].value<Vector3>();
+        if(!restGeometry.contains(n)) continue;
+        const auto & rest = restGeometry[n];
+
+        Vector3 offset = T.topRightCorner<3,1>() + rest.centroid;
 
         // Apply transformation on rest geometry
-        auto nodeGeometry = n->property["restNodeGeometry"].value<Array1D_Vector3>();
-        for(auto & p : nodeGeometry)
-        {
-            Vector3 q = starlab::QVector3(transform * starlab::QVector3((p - n_centroid)));
-            p = q + n_centroid;
-        }
+        auto nodeGeometry = rest.nodePoints;
+        for(auto & p : nodeGeometry) p = linear * (p - rest.centroid) + offset;
         n->setControlPoints(nodeGeometry);
 
-        auto mesh = getMesh(n->id);
-        auto meshPoints = n->property["restMeshGeometry"].value<Array1D_Vector3>();
-        for (auto v : mesh->vertices()){
-            Vector3 p = meshPoints[v.idx()] - n_centroid;
-            p = starlab::QVector3(transform * starlab::QVector3(p));
-            mesh->vertex_coordinates()[v] = p + n_centroid;
-        }
+        auto mesh = detachMesh(n);
+        if(int(mesh->n_vertices()) != rest.meshPoints.cols() || int(mesh->n_faces()) != rest.faceNormals.cols()) continue;
+
+        // Whole buffers at once, written in place
+        auto points = coordinateMatrix(mesh->vertex_coordinates(), mesh->n_vertices());
+        points.noalias() = linear * rest.meshPoints;
+        points.colwise() += offset;
+
+        auto normals = coordinateMatrix(mesh->vertex_normals(), mesh->n_vertices());
+        normals.noalias() = normalMatrix * rest.meshNormals;
+        normals.colwise().normalize();
+
+        auto faceNormals = coordinateMatrix(mesh->face_normals(), mesh->n_faces());
+        faceNormals.noalias() = normalMatrix * rest.faceNormals;
+        faceNormals.colwise().normalize();
 
-        mesh->update_face_normals();
-        mesh->update_vertex_normals();
         mesh->updateBoundingBox();
+        invalidatePartGeometry(n);
     }
 }
 
@@ -694,6 +732,15 @@ Structure::ShapeGraph* Model::cloneAsShapeGraph()
     {
         auto cloneNode = clone->addNode(n->clone());
 
+        // duplicates are placed in the clone's own mesh, this model stays instanced
+        if(isInstance(n))
+        {
+            removeInstanceProperties(cloneNode);
+            auto cloneMesh = instanceMesh(n);
+            if(cloneMesh != nullptr) cloneNode->property["mesh"].setValue(QSharedPointer<SurfaceMeshModel>(cloneMesh));
+            continue;
+        }
+
         // clone meshes as well
         auto mesh = getMesh(n->id);
         auto cloneMesh = mesh->clone();
@@ -726,7 +773,125 @@ Structure::ShapeGraph* Model::cloneAsShapeGraph()
     return clone;
 }
 
+SurfaceMeshModel * Model::detachMesh(Structure::Node * n)
+{
+    auto mesh = n->property["mesh"].value< QSharedPointer<SurfaceMeshModel> >();
+    if(mesh.isNull() || !n->property.value("meshShared").toBool()) return mesh.data();
+
+    auto cloneMesh = QSharedPointer<SurfaceMeshModel>(mesh->clone());
+    cloneMesh->update_face_normals();
+    cloneMesh->update_vertex_normals();
+    cloneMesh->updateBoundingBox();
+    n->property["mesh"].setValue(cloneMesh);
+    n->property.remove("meshShared");
+
+    return cloneMesh.data();
+}
+
+void Model::detachMeshes()
+{
+    expandInstances();
+    for(auto n : nodes) detachMesh(n);
+}
+
+ModelHistory * Model::undoHistory()
+{
+    if(history.isNull()){
+        QSettings settings;
+        size_t budget = size_t(settings.value("history/budgetMB", 256).toULongLong()) * 1024 * 1024;
+        history = QSharedPointer<ModelHistory>(new ModelHistory(this, budget));
+    }
+    return history.data();
+}
+
 QString Model::name()
 {
 	return QFileInfo(Graph::property["name"].toString()).dir().dirName();
 }
+
+bool Model::isInstance(Structure::Node * n)
+{
+    return n->property.contains("instanceTransform");
+}
+
+QMatrix4x4 Model::instanceTransform(Structure::Node * n)
+{
+    if(!isInstance(n)) return QMatrix4x4();
+    return n->property["instanceTransform"].value<QMatrix4x4>();
+}
+
+SurfaceMeshModel * Model::instanceMesh(Structure::Node * n)
+{
+    auto mesh = n->property["mesh"].value< QSharedPointer<SurfaceMeshModel> >();
+    if(mesh.isNull()) return nullptr;
+
+    auto transform = instanceTransform(n);
+    bool isMirrored = n->property["isMirrored"].toBool();
+
+    Eigen::Matrix4d T;
+    for(int i = 0; i < 4; i++)
+        for(int j = 0; j < 4; j++) T(i,j) = transform(i,j);
+
+    auto mapPoint = [&](const Vector3 & p){
+        return Vector3((T * Eigen::Vector4d(p[0], p[1], p[2], 1)).head<3>());
+    };
+
+    SurfaceMeshModel * cloneMesh = nullptr;
+
+    if(isMirrored)
+    {
+        // Reversed faces keep a reflected mesh oriented outwards
+        cloneMesh = new SurfaceMeshModel(n->id + ".obj", n->id);
+        for(auto v : mesh->vertices()) cloneMesh->add_vertex(mapPoint(mesh->vertex_coordinates()[v]));
+        for(auto f : mesh->faces()){
+            std::vector<SurfaceMeshModel::Vertex> verts;
+            for(auto v : mesh->vertices(f)) verts.push_back(v);
+            std::reverse(verts.begin(), verts.end());
+            cloneMesh->add_face(verts);
+        }
+    }
+    else
+    {
+        cloneMesh = mesh->clone();
+        for(auto v : cloneMesh->vertices()){
+            auto & p = cloneMesh->vertex_coordinates()[v];
+            p = mapPoint(p);
+        }
+    }
+
+    cloneMesh->update_face_normals();
+    cloneMesh->update_vertex_normals();
+    cloneMesh->updateBoundingBox();
+    return cloneMesh;
+}
+
+void Model::removeInstanceProperties(Structure::Node * n)
+{
+    n->property.remove("instanceTransform");
+    n->property.remove("isMirrored");
+    n->property.remove("meshShared");
+}
+
+void Model::expandInstance(Structure::Node * n)
+{
+    if(!isInstance(n)) return;
+
+    auto cloneMesh = instanceMesh(n);
+    removeInstanceProperties(n);
+    if(cloneMesh == nullptr) return;
+
+    n->property["mesh"].setValue(QSharedPointer<SurfaceMeshModel>(cloneMesh));
+}
+
+void Model::expandInstances()
+{
+    bool isExpanded = false;
+
+    for(auto n : nodes){
+        if(!isInstance(n)) continue;
+        expandInstance(n);
+        isExpanded = true;
+    }
+
+    if(isExpanded) invalidateGeometry();
+}
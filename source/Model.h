@@ -3,8 +3,13 @@
 #include <QObject>
 #include <QMatrix4x4>
 #include "ShapeGraph.h"
+#include "RenderState.h"
 
 class Viewer;
+class MeshBVH;
+class MeshBuffers;
+class SheetBuffers;
+class ModelHistory;
 
 class Model : public QObject, public Structure::ShapeGraph
 {
@@ -29,6 +34,32 @@ public:
     void selectPart(QVector3D rayOrigin, QVector3D rayDirection);
     void deselectAll();
 
+    // Closest part hit by a ray, empty if none
+    QString pickPart(QVector3D rayOrigin, QVector3D rayDirection);
+    QString pickPartBruteForce(QVector3D rayOrigin, QVector3D rayDirection);
+
+    // Picking structure over all part triangles, built on first use and refit after edits
+    MeshBVH * pickingBVH();
+
+    // Call after part geometry was changed in place, picking and GPU copies are updated
+    void invalidateGeometry(){ isPickingDirty = true; isRenderStateDirty = true; geometryVersion++; meshVersions.clear(); }
+    int geometryVersion;
+
+    // Call after a part's vertices moved in place with the same mesh and counts, only that
+    // part's vertex range is sent to the GPU again
+    void invalidatePartGeometry(Structure::Node * n);
+    QHash<opengp::SurfaceMesh::SurfaceMeshModel*, int> meshVersions;
+
+    // Typed state of nodes then temporary nodes, rebuilt after a notification or when nodes change
+    const QVector<RenderState> & renderStates();
+    void invalidateRenderState(){ isRenderStateDirty = true; }
+
+    // Sets a visual property and notifies the render state
+    void setVisProperty(Structure::Node * n, QString key, QVariant value);
+
+    // Hides the graph's setter, which writes the color without notifying the render state
+    void setColorFor(QString nodeID, QColor color);
+
     Structure::Node * activeNode;
 	void storeActiveNodeGeometry();
 
@@ -36,9 +67,52 @@ public:
 
     Structure::ShapeGraph * cloneAsShapeGraph();
 
+    // Nodes flagged meshShared, duplicates and undo snapshots, get their own copy before
+    // their mesh is modified in place
+    static opengp::SurfaceMesh::SurfaceMeshModel * detachMesh(Structure::Node * n);
+
+    // Every node gets its own mesh before the whole model is changed in place, undo snapshots
+    // and duplicates sharing the meshes keep theirs
+    void detachMeshes();
+
+    // Duplicates share their source mesh and are placed by a transform, mirrored for
+    // reflections, until expanded into their own mesh for editing, saving, or analysis
+    static bool isInstance(Structure::Node * n);
+    static QMatrix4x4 instanceTransform(Structure::Node * n);
+    static void expandInstance(Structure::Node * n);
+    static opengp::SurfaceMesh::SurfaceMeshModel * instanceMesh(Structure::Node * n);
+    static void removeInstanceProperties(Structure::Node * n);
+    void expandInstances();
+
 	QString name();
 
+    // Undo and redo of edits, created on first use
+    ModelHistory * undoHistory();
+
+    // Culling and level of detail counts of the last draw
+    QString renderStats() const;
+
 protected:
+    QSharedPointer<MeshBVH> bvh;
+    bool isPickingDirty;
+
+    QVector<RenderState> renderStateList;
+    bool isRenderStateDirty;
+
+    QSharedPointer<MeshBuffers> buffers;
+    QSharedPointer<SheetBuffers> sheetBuffers;
+
+    // Geometry of the manipulated nodes when the drag started, mesh data relative to the centroid
+    struct RestGeometry{
+        Eigen::Vector3d centroid;
+        Array1D_Vector3 nodePoints;
+        Eigen::Matrix3Xd meshPoints, meshNormals, faceNormals;
+    };
+    QHash<Structure::Node*, RestGeometry> restGeometry;
+
+    QSharedPointer<ModelHistory> history;
+    friend class ModelHistory;
+
     QVector< Structure::Node* > makeDuplicates(Structure::Node* n, QString duplicationOp);
 
 public slots :
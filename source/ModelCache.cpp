@@ -0,0 +1,207 @@
+#include "ModelCache.h"
+#include "Model.h"
+
+#include <QThread>
+
+using namespace opengp;
+
+ModelCache::ModelCache(size_t budgetBytes) : budgetBytes(budgetBytes), totalBytes(0), hits(0), misses(0), evictions(0)
+{
+
+}
+
+QSharedPointer<Model> ModelCache::get(QString name)
+{
+    QMutexLocker locker(&mutex);
+
+    auto it = entries.find(name);
+    if(it == entries.end()){
+        misses++;
+        return QSharedPointer<Model>();
+    }
+
+    // Move to front of the usage list
+    lru.splice(lru.begin(), lru, it->lru);
+
+    hits++;
+    return it->model;
+}
+
+bool ModelCache::contains(QString name)
+{
+    QMutexLocker locker(&mutex);
+    return entries.contains(name);
+}
+
+QSharedPointer<Model> ModelCache::insert(QString name, QSharedPointer<Model> model, bool isPinned)
+{
+    QMutexLocker locker(&mutex);
+
+    // Loaded meanwhile by another thread, keep the one already handed out
+    auto it = entries.find(name);
+    if(it != entries.end()){
+        lru.splice(lru.begin(), lru, it->lru);
+        if(isPinned) it->pins++;
+        return it->model;
+    }
+
+    Entry e;
+    e.model = model;
+    e.bytes = modelSize(model.data());
+    e.pins = isPinned ? 1 : 0;
+    lru.push_front(name);
+    e.lru = lru.begin();
+
+    entries[name] = e;
+    totalBytes += e.bytes;
+
+    evict(name);
+
+    return model;
+}
+
+QSharedPointer<Model> ModelCache::newModel()
+{
+    return QSharedPointer<Model>(new Model(), [](Model * m){
+        if(m->thread() == QThread::currentThread()) delete m;
+        else m->deleteLater();
+    });
+}
+
+void ModelCache::remove(QString name)
+{
+    QMutexLocker locker(&mutex);
+
+    auto it = entries.find(name);
+    if(it == entries.end()) return;
+
+    totalBytes -= it->bytes;
+    lru.erase(it->lru);
+    entries.erase(it);
+}
+
+void ModelCache::clear()
+{
+    QMutexLocker locker(&mutex);
+
+    entries.clear();
+    lru.clear();
+    totalBytes = 0;
+}
+
+bool ModelCache::pin(QString name)
+{
+    QMutexLocker locker(&mutex);
+
+    auto it = entries.find(name);
+    if(it == entries.end()) return false;
+
+    it->pins++;
+    return true;
+}
+
+void ModelCache::unpin(QString name)
+{
+    QMutexLocker locker(&mutex);
+
+    auto it = entries.find(name);
+    if(it != entries.end() && it->pins > 0) it->pins--;
+
+    evict("");
+}
+
+void ModelCache::setBudget(size_t budgetBytes)
+{
+    QMutexLocker locker(&mutex);
+
+    this->budgetBytes = budgetBytes;
+
+    evict("");
+}
+
+size_t ModelCache::budget()
+{
+    QMutexLocker locker(&mutex);
+    return budgetBytes;
+}
+
+void ModelCache::evict(QString keepName)
+{
+    if(budgetBytes == 0) return;
+
+    // Walk from least recently used
+    auto it = lru.end();
+    while(totalBytes > budgetBytes && it != lru.begin())
+    {
+        --it;
+
+        auto & e = entries[*it];
+        if(e.pins > 0 || *it == keepName) continue;
+
+        totalBytes -= e.bytes;
+        entries.remove(*it);
+        it = lru.erase(it);
+        evictions++;
+    }
+}
+
+ModelCache::Stats ModelCache::stats()
+{
+    QMutexLocker locker(&mutex);
+
+    Stats s;
+    s.hits = hits;
+    s.misses = misses;
+    s.evictions = evictions;
+    s.bytes = totalBytes;
+    s.budget = budgetBytes;
+    s.count = entries.size();
+    s.pinned = 0;
+    for(auto & e : entries) if(e.pins > 0) s.pinned++;
+    return s;
+}
+
+QString ModelCache::statsText()
+{
+    auto s = stats();
+    return QString("Model cache: %1 models (%2 pinned), %3 / %4 MB, hits %5, misses %6, evictions %7")
+            .arg(s.count).arg(s.pinned)
+            .arg(double(s.bytes) / (1024 * 1024), 0, 'f', 1)
+            .arg(s.budget ? QString::number(double(s.budget) / (1024 * 1024), 'f', 1) : QString("unlimited"))
+            .arg(s.hits).arg(s.misses).arg(s.evictions);
+}
+
+size_t ModelCache::sizeOf(QString name)
+{
+    QMutexLocker locker(&mutex);
+    return entries.contains(name) ? entries[name].bytes : 0;
+}
+
+size_t ModelCache::modelSize(Model * model)
+{
+    if(model == nullptr) return 0;
+
+    size_t bytes = sizeof(Model);
+
+    for(auto n : model->nodes)
+    {
+        // Skeleton
+        bytes += n->controlPoints().size() * sizeof(Vector3);
+
+        bytes += meshSize(model->getMesh(n->id));
+    }
+
+    return bytes;
+}
+
+size_t ModelCache::meshSize(SurfaceMeshModel * mesh)
+{
+    if(mesh == nullptr) return 0;
+
+    // Positions and normals per vertex, normals per face, connectivity
+    size_t bytes = 0;
+    bytes += mesh->n_vertices() * (2 * sizeof(Vector3) + sizeof(int) * 2);
+    bytes += mesh->n_faces() * (sizeof(Vector3) + sizeof(int) * 2);
+    bytes += mesh->n_halfedges() * (sizeof(int) * 4);
+    return bytes;
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <QString>
+#include <QStringList>
+#include <QHash>
+#include <QSharedPointer>
+#include <QMutex>
+#include <list>
+
+class Model;
+namespace opengp{ namespace SurfaceMesh{ class SurfaceMeshModel; } }
+
+// Dataset models kept in memory under a byte budget, least recently used models are evicted first
+class ModelCache
+{
+public:
+    ModelCache(size_t budgetBytes = 0);
+
+    // Models are handed out shared, one evicted while in use lives until its last holder
+    // releases it. Raw pointers into the cache are only safe on pinned models.
+    // Returns null when the model is not cached
+    QSharedPointer<Model> get(QString name);
+    bool contains(QString name);
+
+    // Takes ownership and evicts older models if over budget, an already cached model is kept
+    QSharedPointer<Model> insert(QString name, QSharedPointer<Model> model, bool isPinned = false);
+
+    // New model whose last release deletes it on its own thread, with deleteLater when
+    // released elsewhere, as models are loaded and evicted from worker threads
+    static QSharedPointer<Model> newModel();
+    void remove(QString name);
+    void clear();
+
+    // Pinned models are never evicted, pins are counted. False if not cached
+    bool pin(QString name);
+    void unpin(QString name);
+
+    // Zero means unlimited
+    void setBudget(size_t budgetBytes);
+    size_t budget();
+
+    struct Stats{
+        quint64 hits, misses, evictions;
+        size_t bytes, budget;
+        int count, pinned;
+    };
+    Stats stats();
+    QString statsText();
+
+    size_t sizeOf(QString name);
+    static size_t modelSize(Model * model);
+    static size_t meshSize(opengp::SurfaceMesh::SurfaceMeshModel * mesh);
+
+protected:
+    struct Entry{
+        QSharedPointer<Model> model;
+        size_t bytes;
+        int pins;
+        std::list<QString>::iterator lru;
+    };
+
+    QHash<QString, Entry> entries;
+    std::list<QString> lru; // most recently used first
+
+    size_t budgetBytes, totalBytes;
+    quint64 hits, misses, evictions;
+
+    QMutex mutex;
+
+    void evict(QString keepName);
+};
@@ -8,6 +8,8 @@ ModelConnector::ModelConnector(Model *g)
 {
     QMap<QString, int> nodeID;
 
+    g->expandInstances();
+
     PQP::Manager m(g->nodes.size());
 
     // load up meshes for all parts
@@ -0,0 +1,207 @@
+#include "ModelHistory.h"
+#include "Model.h"
+#include "ModelCache.h"
+
+#include <QSet>
+
+using namespace opengp;
+
+ModelHistory::ModelHistory(Model * model, size_t budgetBytes) : model(model), budgetBytes(budgetBytes)
+{
+
+}
+
+static QSharedPointer<SurfaceMeshModel> nodeMesh(Structure::Node * n)
+{
+    return n->property["mesh"].value< QSharedPointer<SurfaceMeshModel> >();
+}
+
+// Frozen node still describes the live one
+static bool isSameNode(Structure::Node * live, Structure::Node * frozen)
+{
+    if(live->id != frozen->id || live->type() != frozen->type()) return false;
+    if(nodeMesh(live) != nodeMesh(frozen)) return false;
+    if(Model::instanceTransform(live) != Model::instanceTransform(frozen)) return false;
+    if(live->vis_property.value("color") != frozen->vis_property.value("color")) return false;
+    if(live->vis_property.value("isHidden").toBool() != frozen->vis_property.value("isHidden").toBool()) return false;
+    return live->controlPoints() == frozen->controlPoints();
+}
+
+ModelHistory::Snapshot ModelHistory::capture(QString label, const Snapshot * previous)
+{
+    Snapshot snapshot;
+    snapshot.label = label;
+
+    QHash< QString, QSharedPointer<Structure::Node> > previousNodes;
+    if(previous != nullptr)
+        for(auto f : previous->nodes) previousNodes[f->id] = f;
+
+    for(auto n : model->nodes)
+    {
+        auto f = previousNodes.value(n->id);
+        if(!f.isNull() && isSameNode(n, f.data())){
+            snapshot.nodes << f;
+            continue;
+        }
+
+        f = QSharedPointer<Structure::Node>(n->clone());
+        f->property["mesh"].setValue(nodeMesh(n));
+
+        // The model must copy the mesh before changing it in place, through detachMesh or detachMeshes
+        if(!nodeMesh(n).isNull()) n->property["meshShared"].setValue(true);
+
+        snapshot.nodes << f;
+    }
+
+    for(auto e : model->edges)
+    {
+        EdgeState edge;
+        edge.id = e->id;
+        edge.n1 = e->n1->id;
+        edge.n2 = e->n2->id;
+        edge.coord = e->coord;
+        edge.property = e->property;
+        snapshot.edges << edge;
+    }
+
+    snapshot.groups = model->groups;
+    if(model->activeNode != nullptr) snapshot.activeNodeID = model->activeNode->id;
+
+    return snapshot;
+}
+
+bool ModelHistory::isSameState(const Snapshot & a, const Snapshot & b)
+{
+    if(a.nodes != b.nodes || a.edges.size() != b.edges.size() || a.groups != b.groups) return false;
+
+    for(int i = 0; i < a.edges.size(); i++){
+        auto & ea = a.edges[i], & eb = b.edges[i];
+        if(ea.id != eb.id || ea.n1 != eb.n1 || ea.n2 != eb.n2) return false;
+    }
+
+    return true;
+}
+
+void ModelHistory::restore(const Snapshot & snapshot)
+{
+    QStringList liveNodes;
+    for(auto n : model->nodes) liveNodes << n->id;
+    for(auto nid : liveNodes) model->removeNode(nid);
+
+    for(auto f : snapshot.nodes)
+    {
+        auto n = model->addNode(f->clone());
+        n->property["mesh"].setValue(nodeMesh(f.data()));
+        if(!nodeMesh(f.data()).isNull()) n->property["meshShared"].setValue(true);
+    }
+
+    for(auto & edge : snapshot.edges)
+    {
+        auto n1 = model->getNode(edge.n1), n2 = model->getNode(edge.n2);
+        if(n1 == nullptr || n2 == nullptr) continue;
+        auto newEdge = model->addEdge(n1, n2, edge.coord[0], edge.coord[1], edge.id);
+        newEdge->property = edge.property;
+    }
+
+    model->groups = snapshot.groups;
+    model->activeNode = snapshot.activeNodeID.isEmpty() ? nullptr : model->getNode(snapshot.activeNodeID);
+    model->tempNodes.clear();
+    model->restGeometry.clear();
+    model->invalidateGeometry();
+}
+
+void ModelHistory::record(QString label)
+{
+    auto snapshot = capture(label, undoStack.empty() ? nullptr : &undoStack.back());
+
+    // The last recorded edit changed nothing, such as a click without a drag
+    if(!undoStack.empty() && isSameState(snapshot, undoStack.back()))
+        undoStack.back() = snapshot;
+    else
+        undoStack << snapshot;
+
+    redoStack.clear();
+    trim();
+}
+
+bool ModelHistory::undo()
+{
+    if(undoStack.empty()) return false;
+
+    auto previous = undoStack.takeLast();
+    redoStack << capture(previous.label, &previous);
+    restore(previous);
+    return true;
+}
+
+bool ModelHistory::redo()
+{
+    if(redoStack.empty()) return false;
+
+    auto next = redoStack.takeLast();
+    undoStack << capture(next.label, &next);
+    restore(next);
+    trim();
+    return true;
+}
+
+QString ModelHistory::undoLabel() const
+{
+    return undoStack.empty() ? QString() : undoStack.back().label;
+}
+
+QString ModelHistory::redoLabel() const
+{
+    return redoStack.empty() ? QString() : redoStack.back().label;
+}
+
+void ModelHistory::setBudget(size_t budgetBytes)
+{
+    this->budgetBytes = budgetBytes;
+    trim();
+}
+
+size_t ModelHistory::memoryUsed() const
+{
+    // Shared nodes and meshes are counted once
+    QSet<Structure::Node*> countedNodes;
+    QSet<SurfaceMeshModel*> countedMeshes;
+    size_t bytes = 0;
+
+    for(auto stack : {&undoStack, &redoStack})
+    {
+        for(auto & snapshot : *stack)
+        {
+            bytes += sizeof(Snapshot) + snapshot.edges.size() * sizeof(EdgeState);
+
+            for(auto f : snapshot.nodes)
+            {
+                if(countedNodes.contains(f.data())) continue;
+                countedNodes << f.data();
+                bytes += sizeof(Structure::Node) + f->controlPoints().size() * sizeof(Vector3);
+
+                auto mesh = nodeMesh(f.data()).data();
+                if(mesh == nullptr || countedMeshes.contains(mesh)) continue;
+                countedMeshes << mesh;
+                bytes += ModelCache::meshSize(mesh);
+            }
+        }
+    }
+
+    return bytes;
+}
+
+void ModelHistory::trim()
+{
+    if(budgetBytes == 0) return;
+
+    // Keep at least the last undo step
+    while(undoStack.size() > 1 && memoryUsed() > budgetBytes)
+        undoStack.removeFirst();
+}
+
+void ModelHistory::clear()
+{
+    undoStack.clear();
+    redoStack.clear();
+}
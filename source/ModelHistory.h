@@ -0,0 +1,61 @@
+#pragma once
+
+#include <QString>
+#include <QVector>
+#include <QSharedPointer>
+
+#include "ShapeGraph.h"
+
+class Model;
+
+// Undo and redo of Model edits. A snapshot keeps frozen copies of the nodes; nodes that did not
+// change since the previous snapshot are shared with it, and meshes are shared with the model
+// until it detaches them for an edit. A snapshot costs only the parts changed since the last one.
+class ModelHistory
+{
+public:
+    ModelHistory(Model * model, size_t budgetBytes = 0);
+
+    // Call before an edit, the current state is kept for undo
+    void record(QString label);
+
+    bool undo();
+    bool redo();
+
+    bool canUndo() const { return !undoStack.empty(); }
+    bool canRedo() const { return !redoStack.empty(); }
+    QString undoLabel() const;
+    QString redoLabel() const;
+
+    // Oldest undo steps are dropped when over budget, zero means unlimited
+    void setBudget(size_t budgetBytes);
+    size_t budget() const { return budgetBytes; }
+    size_t memoryUsed() const;
+
+    void clear();
+
+protected:
+    struct EdgeState{
+        QString id, n1, n2;
+        decltype(Structure::Link::coord) coord;
+        decltype(Structure::Link::property) property;
+    };
+
+    struct Snapshot{
+        QString label;
+        QVector< QSharedPointer<Structure::Node> > nodes;
+        QVector<EdgeState> edges;
+        decltype(Structure::ShapeGraph::groups) groups;
+        QString activeNodeID;
+    };
+
+    Model * model;
+    QVector<Snapshot> undoStack, redoStack;
+    size_t budgetBytes;
+
+    // Frozen copy of the model, unchanged nodes are taken from the previous snapshot
+    Snapshot capture(QString label, const Snapshot * previous);
+    static bool isSameState(const Snapshot & a, const Snapshot & b);
+    void restore(const Snapshot & snapshot);
+    void trim();
+};
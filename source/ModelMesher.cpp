@@ -8,6 +8,9 @@
 
 #include "RMF.h"
 
+#include <QElapsedTimer>
+#include <functional>
+
 ModelMesher::ModelMesher(Model *model) : m(model)
 {
 
@@ -17,7 +20,7 @@ void ModelMesher::generateOffsetSurface(double offset)
 {
     if(m->activeNode == nullptr) return;
     auto n = m->activeNode;
-    n->vis_property["isSmoothShading"].setValue(true);
+    m->setVisProperty(n, "isSmoothShading", true);
 
     switch(m->QObject::property("meshingIsThick").toInt()){
     case 0: break;
@@ -107,37 +110,23 @@ void ModelMesher::generateOffsetSurface(double offset)
 
     if (faceList.empty() || vertList.empty()) return;
 
-    Array3f phi_grid;
-    SDFGen::make_level_set3(faceList, vertList, min_box, dx, sizes[0], sizes[1], sizes[2], phi_grid, false, offset * 2.0);
-
-    ScalarVolume volume = initScalarVolume(sizes[0], sizes[1], sizes[2], (sizes[0] + sizes[1] + sizes[2])*dx);
-
-    for(int i = 0; i < sizes[0]; i++){
-        for(int j = 0; j < sizes[1]; j++){
-            for(int k = 0; k < sizes[2]; k++){
-                volume[k][j][i] = phi_grid(i,j,k);
-            }
-        }
-    }
+    // Distances only near the skeleton, the surface lies at half the band
+    SparseArray3f phi_grid;
+    SDFGen::make_level_set3_narrow_band(faceList, vertList, min_box, dx, sizes[0], sizes[1], sizes[2], phi_grid, offset * 2.0);
 
-    // Mesh surface from volume using marching cubes
-    auto mesh = march(volume, offset);
+    // Mesh surface from volume using marching cubes, vertices are already shared
+    auto mesh = march_indexed(phi_grid, offset);
 
     QSharedPointer<SurfaceMeshModel> newMesh = QSharedPointer<SurfaceMeshModel>(new SurfaceMeshModel());
 
-    int vi = 0;
-    for(auto tri : mesh){
-        std::vector<SurfaceMeshModel::Vertex> verts;
-        for(auto p : tri){
-            Vector3 voxel(p.x, p.y, p.z);
-            Vector3 pos = (voxel * dx) + Vector3(min_box[0],min_box[1],min_box[2]);
-            newMesh->add_vertex(pos);
-            verts.push_back(SurfaceMeshModel::Vertex(vi++));
-        }
-        newMesh->add_face(verts);
+    for(auto p : mesh.vertices){
+        Vector3 voxel(p.x, p.y, p.z);
+        newMesh->add_vertex((voxel * dx) + Vector3(min_box[0],min_box[1],min_box[2]));
     }
 
-    GeometryHelper::meregeVertices<Vector3>(newMesh.data());
+    typedef SurfaceMeshModel::Vertex Vert;
+    for(size_t i = 0; i + 2 < mesh.triangles.size(); i += 3)
+        newMesh->add_triangle(Vert(mesh.triangles[i]), Vert(mesh.triangles[i+1]), Vert(mesh.triangles[i+2]));
 
     newMesh->updateBoundingBox();
     newMesh->update_face_normals();
@@ -145,13 +134,15 @@ void ModelMesher::generateOffsetSurface(double offset)
 
 	n->property["mesh"].setValue(newMesh);
 	n->property["mesh_filename"].setValue(QString("meshes/%1.obj").arg(n->id));
+	n->property.remove("instanceTransform");
+	n->property.remove("isMirrored");
 }
 
 void ModelMesher::generateRegularSurface(double offset)
 {
     if(m->activeNode == nullptr) return;
     auto n = m->activeNode;
-    n->vis_property["isSmoothShading"].setValue(true);
+    m->setVisProperty(n, "isSmoothShading", true);
 
     Structure::Curve* curve = dynamic_cast<Structure::Curve*>(n);
     Structure::Sheet* sheet = dynamic_cast<Structure::Sheet*>(n);
@@ -175,7 +166,7 @@ void ModelMesher::generateRegularSurface(double offset)
     case 1: offset *= 2; break;
     case 2: offset *= 8; break;
     }
-    if(isFlat) n->vis_property["isSmoothShading"].setValue(false);
+    if(isFlat) m->setVisProperty(n, "isSmoothShading", false);
 
     if(curve)
     {
@@ -320,5 +311,186 @@ void ModelMesher::generateRegularSurface(double offset)
 
 	n->property["mesh"].setValue(newMesh);
 	n->property["mesh_filename"].setValue(QString("meshes/%1.obj").arg(n->id));
+	n->property.remove("instanceTransform");
+	n->property.remove("isMirrored");
+}
+
+
+QStringList ModelMesher::benchmarkLevelSet(Model * model, double dx)
+{
+    std::vector<SDFGen::Vec3f> vertList;
+    std::vector<SDFGen::Vec3ui> faceList;
+    SDFGen::Vec3f min_box(std::numeric_limits<float>::max(),std::numeric_limits<float>::max(),std::numeric_limits<float>::max()),
+        max_box(-std::numeric_limits<float>::max(),-std::numeric_limits<float>::max(),-std::numeric_limits<float>::max());
+
+    // Triangles of all parts in one list
+    for(auto n : model->nodes)
+    {
+        auto mesh = model->getMesh(n->id);
+        if(mesh == nullptr) continue;
+
+        unsigned int offset = (unsigned int)vertList.size();
+        auto points = mesh->vertex_coordinates();
+        for(auto v : mesh->vertices()){
+            SDFGen::Vec3f p(points[v][0], points[v][1], points[v][2]);
+            vertList.push_back(p);
+            update_minmax(p, min_box, max_box);
+        }
+
+        for(auto f : mesh->faces()){
+            std::vector<unsigned int> fv;
+            for(auto v : mesh->vertices(f)) fv.push_back(offset + v.idx());
+            for(size_t i = 2; i < fv.size(); i++) faceList.push_back(SDFGen::Vec3ui(fv[0], fv[i-1], fv[i]));
+        }
+    }
+
+    QStringList lines;
+    if(faceList.empty()){
+        lines << "No part meshes";
+        return lines;
+    }
+
+    int padding = 10;
+    SDFGen::Vec3f unit(1,1,1);
+    min_box -= unit*padding*dx;
+    max_box += unit*padding*dx;
+    SDFGen::Vec3ui sizes = SDFGen::Vec3ui((max_box - min_box)/dx);
+
+    Array3f serial, parallel;
+    QElapsedTimer timer;
+
+    timer.start();
+    SDFGen::make_level_set3_serial(faceList, vertList, min_box, dx, sizes[0], sizes[1], sizes[2], serial);
+    double serialTime = timer.nsecsElapsed() * 1e-6;
+
+    timer.restart();
+    SDFGen::make_level_set3(faceList, vertList, min_box, dx, sizes[0], sizes[1], sizes[2], parallel);
+    double parallelTime = timer.nsecsElapsed() * 1e-6;
+
+    size_t numDifferent = 0;
+    float maxDifference = 0;
+    for(size_t i = 0; i < serial.a.size(); i++){
+        float d = std::abs(serial.a[i] - parallel.a[i]);
+        if(d > 0) numDifferent++;
+        maxDifference = std::max(maxDifference, d);
+    }
+
+    lines << QString("%1 triangles, grid %2 x %3 x %4").arg(faceList.size()).arg(sizes[0]).arg(sizes[1]).arg(sizes[2]);
+    lines << QString("  serial    %1 ms").arg(serialTime);
+    lines << QString("  parallel  %1 ms (%2x)").arg(parallelTime).arg(serialTime / std::max(parallelTime, 1e-9));
+    lines << QString("  different %1 of %2 cells, at most %3").arg(numDifferent).arg(serial.a.size()).arg(maxDifference);
+
+    // Band of the default offset surface, dense against bricks
+    float band = 0.05f;
+    Array3f dense;
+    SparseArray3f narrow;
+
+    timer.restart();
+    SDFGen::make_level_set3(faceList, vertList, min_box, dx, sizes[0], sizes[1], sizes[2], dense, false, band);
+    double denseTime = timer.nsecsElapsed() * 1e-6;
+
+    timer.restart();
+    SDFGen::make_level_set3_narrow_band(faceList, vertList, min_box, dx, sizes[0], sizes[1], sizes[2], narrow, band);
+    double narrowTime = timer.nsecsElapsed() * 1e-6;
+
+    // Sweeping only approximates distances away from the triangles, exact ones can be smaller
+    float maxCloser = 0;
+    for(int k = 0; k < dense.nk; k++)
+        for(int j = 0; j < dense.nj; j++)
+            for(int i = 0; i < dense.ni; i++)
+                maxCloser = std::max(maxCloser, dense(i,j,k) - narrow(i,j,k));
+
+    // Closest triangle and intersection counts are dense too
+    double denseMB = serial.a.size() * (sizeof(float) + 2 * sizeof(int)) / (1024.0 * 1024.0);
+    double narrowMB = narrow.memory() / (1024.0 * 1024.0);
+
+    lines << QString("  band %1 dense  %2 ms, %3 MB").arg(band).arg(denseTime).arg(denseMB);
+    lines << QString("  band %1 bricks %2 ms, %3 MB in %4 bricks, at most %5 closer")
+             .arg(band).arg(narrowTime).arg(narrowMB).arg(narrow.num_bricks()).arg(maxCloser);
+
+    // Surfaces at the default offset, the dense field is marched in place
+    timer.restart();
+    auto denseMesh = march(dense, band * 0.5);
+    double denseMarchTime = timer.nsecsElapsed() * 1e-6;
+
+    timer.restart();
+    auto narrowMesh = march(narrow, band * 0.5);
+    double narrowMarchTime = timer.nsecsElapsed() * 1e-6;
+
+    lines << QString("  march dense  %1 ms, %2 triangles").arg(denseMarchTime).arg(denseMesh.size() / 3);
+    lines << QString("  march bricks %1 ms, %2 triangles").arg(narrowMarchTime).arg(narrowMesh.size() / 3);
+
+    timer.restart();
+    auto indexedMesh = march_indexed(narrow, band * 0.5);
+    double indexedMarchTime = timer.nsecsElapsed() * 1e-6;
+
+    lines << QString("  march bricks indexed %1 ms, %2 triangles, %3 vertices")
+             .arg(indexedMarchTime).arg(indexedMesh.triangles.size() / 3).arg(indexedMesh.vertices.size());
+    return lines;
 }
 
+QStringList ModelMesher::benchmarkMarch(int gridSize, int repeats)
+{
+    int n = std::max(gridSize, 2);
+    float radius = n / 3.0f, band = 2.0f;
+
+    // A sphere, a gyroid crossing most cells, and a shell around the sphere as offset surfaces
+    // mesh it: unsigned distances clamped to a band, dense and in bricks near the surface
+    Array3f sphere(n, n, n), gyroid(n, n, n), shell(n, n, n);
+    SparseArray3f shellBricks;
+    shellBricks.resize(n, n, n, band);
+
+    for(int k = 0; k < n; k++){
+        for(int j = 0; j < n; j++){
+            for(int i = 0; i < n; i++){
+                float x = i - n * 0.5f, y = j - n * 0.5f, z = k - n * 0.5f;
+                float d = std::sqrt(x*x + y*y + z*z) - radius;
+                sphere(i,j,k) = d;
+                shell(i,j,k) = std::min(std::abs(d), band);
+
+                float s = 0.3f;
+                gyroid(i,j,k) = std::sin(i*s)*std::cos(j*s) + std::sin(j*s)*std::cos(k*s) + std::sin(k*s)*std::cos(i*s);
+
+                // Bricks reach two cells past the band, more than a cell diagonal, so cells
+                // starting outside them cannot touch the surface
+                if(std::abs(d) < band + 2)
+                    shellBricks.allocate_brick(i >> SparseArray3f::brick_bits, j >> SparseArray3f::brick_bits, k >> SparseArray3f::brick_bits);
+            }
+        }
+    }
+
+    for(int b = 0; b < shellBricks.num_bricks(); b++){
+        int size = SparseArray3f::brick_size;
+        int i0 = shellBricks.brick_coords[b*3+0] * size, j0 = shellBricks.brick_coords[b*3+1] * size, k0 = shellBricks.brick_coords[b*3+2] * size;
+        for(int k = k0; k < std::min(k0 + size, n); k++)
+            for(int j = j0; j < std::min(j0 + size, n); j++)
+                for(int i = i0; i < std::min(i0 + size, n); i++)
+                    shellBricks.at(b, i, j, k) = shell(i,j,k);
+    }
+
+    QStringList lines;
+    lines << QString("grid %1^3, best of %2").arg(n).arg(std::max(repeats, 1));
+
+    // Best time of the repeats, cells per second count every cell of the grid
+    auto time = [&](QString name, std::function<size_t()> marchVolume){
+        double best = std::numeric_limits<double>::max();
+        size_t numTriangles = 0;
+        for(int r = 0; r < std::max(repeats, 1); r++){
+            QElapsedTimer timer;
+            timer.start();
+            numTriangles = marchVolume();
+            best = std::min(best, timer.nsecsElapsed() * 1e-6);
+        }
+        double cells = double(n - 1) * (n - 1) * (n - 1);
+        lines << QString("  %1 %2 ms, %3 triangles, %4 M cells/s").arg(name, -14).arg(best)
+                 .arg(numTriangles).arg(cells / (best * 1e3));
+    };
+
+    time("sphere", [&]{ return march(sphere, 0.0).size() / 3; });
+    time("gyroid", [&]{ return march(gyroid, 0.0).size() / 3; });
+    time("shell", [&]{ return march(shell, 1.0).size() / 3; });
+    time("shell bricks", [&]{ return march(shellBricks, 1.0).size() / 3; });
+    time("shell indexed", [&]{ return march_indexed(shellBricks, 1.0).triangles.size() / 3; });
+
+    return lines;
+}
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <QStringList>
+
 class Model;
 
 class ModelMesher
@@ -10,6 +12,12 @@ public:
     void generateOffsetSurface(double offset);
     void generateRegularSurface(double offset);
 
+    // Times the serial and parallel distance fields of all part meshes, as lines of text
+    static QStringList benchmarkLevelSet(Model * model, double dx);
+
+    // Times marching cubes on analytic volumes of the given grid size, as lines of text
+    static QStringList benchmarkMarch(int gridSize, int repeats = 3);
+
 private:
     Model * m;
 };
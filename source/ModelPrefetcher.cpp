@@ -0,0 +1,164 @@
+#include "ModelPrefetcher.h"
+#include "Document.h"
+#include "Model.h"
+
+#include <QThread>
+#include <QRunnable>
+#include <QFileInfo>
+
+class ModelLoadRunnable : public QRunnable
+{
+public:
+    ModelLoadRunnable(ModelPrefetcher * prefetcher, QString name, QString filename, bool isPinned) :
+        prefetcher(prefetcher), name(name), filename(filename), isPinned(isPinned){}
+
+    void run(){ prefetcher->load(name, filename, isPinned); }
+
+    ModelPrefetcher * prefetcher;
+    QString name, filename;
+    bool isPinned;
+};
+
+ModelPrefetcher::ModelPrefetcher(Document * document, int numWorkers) : document(document),
+    numDone(0), numTotal(0), numParsed(0), bytesParsed(0), lastDone(0)
+{
+    if(numWorkers < 1) numWorkers = QThread::idealThreadCount();
+    pool.setMaxThreadCount(numWorkers);
+}
+
+ModelPrefetcher::~ModelPrefetcher()
+{
+    pool.waitForDone();
+}
+
+void ModelPrefetcher::prefetch(QStringList names, bool isPinned)
+{
+    QStringList ready, missing;
+    int done, total;
+
+    {
+        QMutexLocker locker(&mutex);
+
+        if(!timer.isValid()) timer.start();
+
+        for(auto name : names)
+        {
+            if(pending.contains(name)) continue;
+
+            // Already in memory
+            bool isCached = isPinned ? document->cachedModels.pin(name) : document->cachedModels.contains(name);
+            if(isCached){
+                ready << name;
+                continue;
+            }
+
+            // Dataset entries are only read here, workers get the file name
+            if(!document->dataset.contains(name)){
+                failed << name;
+                missing << name;
+                continue;
+            }
+
+            QString filename = document->dataset[name]["graphFile"].toString();
+
+            pending << name;
+            failed.remove(name);
+            numTotal++;
+            pool.start(new ModelLoadRunnable(this, name, filename, isPinned));
+        }
+
+        numTotal += ready.size() + missing.size();
+        numDone += ready.size() + missing.size();
+        done = numDone;
+        total = numTotal;
+    }
+
+    // Signals are sent unlocked so receivers can wait on other models
+    for(auto name : ready) emit(modelReady(name));
+    for(auto name : missing) emit(modelFailed(name));
+    if(!ready.empty() || !missing.empty()) emit(progress(done, total));
+}
+
+void ModelPrefetcher::load(QString name, QString filename, bool isPinned)
+{
+    auto model = ModelCache::newModel();
+    bool isLoaded = model->loadFromFile(filename);
+
+    size_t bytes = 0;
+    int done, total;
+    if(isLoaded)
+    {
+        // Models are used and destroyed by the document's thread
+        model->moveToThread(document->thread());
+
+        document->applyPartColors(name, model.data());
+
+        bytes = ModelCache::modelSize(model.data());
+        document->cachedModels.insert(name, model, isPinned);
+    }
+
+    {
+        QMutexLocker locker(&mutex);
+
+        pending.remove(name);
+        if(!isLoaded) failed << name;
+
+        numDone++;
+        lastDone = timer.elapsed();
+        if(isLoaded){
+            numParsed++;
+            bytesParsed += bytes;
+        }
+        done = numDone;
+        total = numTotal;
+
+        readyCondition.wakeAll();
+    }
+
+    if(isLoaded) emit(modelReady(name));
+    else emit(modelFailed(name));
+    emit(progress(done, total));
+}
+
+Model * ModelPrefetcher::wait(QString name)
+{
+    {
+        QMutexLocker locker(&mutex);
+        while(pending.contains(name)) readyCondition.wait(&mutex);
+        if(failed.contains(name)) return nullptr;
+    }
+
+    return document->cachedModels.get(name).data();
+}
+
+void ModelPrefetcher::waitForDone()
+{
+    pool.waitForDone();
+}
+
+int ModelPrefetcher::numLoaded()
+{
+    QMutexLocker locker(&mutex);
+    return numParsed;
+}
+
+double ModelPrefetcher::loadedMB()
+{
+    QMutexLocker locker(&mutex);
+    return double(bytesParsed) / (1024 * 1024);
+}
+
+double ModelPrefetcher::elapsedSeconds()
+{
+    QMutexLocker locker(&mutex);
+    return lastDone / 1000.0;
+}
+
+QString ModelPrefetcher::throughputText()
+{
+    double seconds = qMax(elapsedSeconds(), 1e-3);
+    return QString("Loaded %1 models (%2 MB) in %3 s, %4 models/s, %5 MB/s, %6 threads")
+            .arg(numLoaded()).arg(loadedMB(), 0, 'f', 1).arg(seconds, 0, 'f', 2)
+            .arg(numLoaded() / seconds, 0, 'f', 1).arg(loadedMB() / seconds, 0, 'f', 1)
+            .arg(pool.maxThreadCount());
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <QObject>
+#include <QStringList>
+#include <QSet>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QThreadPool>
+#include <QElapsedTimer>
+
+class Document;
+class Model;
+
+// Loads dataset models into the document cache on a pool of workers. Models are handed
+// out as soon as they are parsed, either through modelReady or by waiting on a name.
+class ModelPrefetcher : public QObject
+{
+    Q_OBJECT
+public:
+    explicit ModelPrefetcher(Document * document, int numWorkers = -1);
+    ~ModelPrefetcher();
+
+    // Queues loading of models not already cached, returns immediately.
+    // Pinned models stay in the cache until the caller unpins them.
+    void prefetch(QStringList names, bool isPinned = false);
+
+    // Blocks until the named model is loaded, nullptr if it failed or was never queued.
+    // The pointer stays valid only while the model is pinned.
+    Model * wait(QString name);
+    void waitForDone();
+
+    // Load statistics
+    int numLoaded();
+    double loadedMB();
+    double elapsedSeconds();
+    QString throughputText();
+
+signals:
+    void modelReady(QString name);
+    void modelFailed(QString name);
+    void progress(int numDone, int numTotal);
+
+protected:
+    Document * document;
+    QThreadPool pool;
+
+    QMutex mutex;
+    QWaitCondition readyCondition;
+    QSet<QString> pending, failed;
+    int numDone, numTotal, numParsed;
+    size_t bytesParsed;
+    QElapsedTimer timer;
+    qint64 lastDone;
+
+    void load(QString name, QString filename, bool isPinned);
+
+    friend class ModelLoadRunnable;
+};
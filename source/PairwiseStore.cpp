@@ -0,0 +1,233 @@
+#include "PairwiseStore.h"
+
+#include <QFile>
+#include <QSaveFile>
+#include <QFileInfo>
+#include <QDir>
+#include <QTextStream>
+#include <QStringList>
+#include <QCryptographicHash>
+
+#include "ShapeGraph.h"
+
+using namespace opengp;
+
+PairwiseStore::PairwiseStore(QString filename) : filename(filename), numFileRecords(0)
+{
+
+}
+
+QString PairwiseStore::shapeHash(Structure::ShapeGraph * shape)
+{
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+
+    for(auto n : shape->nodes)
+    {
+        hash.addData(n->id.toUtf8());
+        hash.addData(QByteArray::number(int(n->type())));
+
+        // Skeleton geometry
+        for(auto & p : n->controlPoints())
+            hash.addData((const char*)p.data(), sizeof(double) * 3);
+
+        // Part geometry
+        auto mesh = shape->getMesh(n->id);
+        if(mesh == nullptr) continue;
+
+        auto points = mesh->vertex_coordinates();
+        for(auto v : mesh->vertices())
+            hash.addData((const char*)points[v].data(), sizeof(double) * 3);
+
+        for(auto f : mesh->faces()){
+            for(auto v : mesh->vertices(f)){
+                int vidx = v.idx();
+                hash.addData((const char*)&vidx, sizeof(int));
+            }
+        }
+    }
+
+    // Structure
+    for(auto e : shape->edges){
+        hash.addData(e->n1->id.toUtf8());
+        hash.addData(e->n2->id.toUtf8());
+    }
+
+    for(auto g : shape->groups){
+        hash.addData("|");
+        for(auto nid : g) hash.addData(nid.toUtf8());
+    }
+
+    return hash.result().toHex();
+}
+
+QString PairwiseStore::optionsHash(const QVariantMap & options)
+{
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+
+    // Only options that change the search result take part in the key
+    for(auto key : options.keys())
+    {
+        if(key == "isQuietMode") continue;
+        hash.addData(QString("%1=%2;").arg(key).arg(options[key].toString()).toUtf8());
+    }
+
+    return hash.result().toHex();
+}
+
+QString PairwiseStore::pairKey(QString sourceHash, QString targetHash, QString optionsHash)
+{
+    return QString("%1-%2-%3").arg(sourceHash).arg(targetHash).arg(optionsHash);
+}
+
+bool PairwiseStore::load()
+{
+    return loadFrom(filename);
+}
+
+bool PairwiseStore::loadFrom(QString otherFile)
+{
+    QMutexLocker locker(&mutex);
+
+    QFile file(otherFile);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) return false;
+
+    bool isOwnFile = QFileInfo(otherFile) == QFileInfo(filename);
+
+    QTextStream in(&file);
+    while (!in.atEnd())
+    {
+        QString key;
+        QVariantMap result;
+        if(fromRecord(in.readLine(), key, result))
+        {
+            entries[key] = result;
+
+            if(isOwnFile){
+                fileKeys.insert(key);
+                numFileRecords++;
+            }
+        }
+    }
+
+    return true;
+}
+
+bool PairwiseStore::contains(QString key)
+{
+    QMutexLocker locker(&mutex);
+    return entries.contains(key);
+}
+
+QVariantMap PairwiseStore::get(QString key)
+{
+    QMutexLocker locker(&mutex);
+    return entries.value(key);
+}
+
+void PairwiseStore::insert(QString key, QString source, QString target, const QVariantMap & result)
+{
+    QMutexLocker locker(&mutex);
+
+    QString line = toRecord(key, source, target, result);
+
+    // Keep only what the parsed record would give back
+    QVariantMap stored;
+    fromRecord(line, key, stored);
+    entries[key] = stored;
+
+    QDir().mkpath(QFileInfo(filename).absolutePath());
+
+    QFile file(filename);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Append | QIODevice::Text)) return;
+    QTextStream out(&file);
+    out << line << "\n";
+
+    fileKeys.insert(key);
+    numFileRecords++;
+}
+
+int PairwiseStore::merge(QString otherFile)
+{
+    PairwiseStore other(otherFile);
+    if(!other.load()) return 0;
+
+    int numAdded = 0;
+    for(auto key : other.entries.keys())
+    {
+        if(contains(key)) continue;
+
+        auto result = other.entries[key];
+        insert(key, result["source"].toString(), result["target"].toString(), result);
+        numAdded++;
+    }
+
+    return numAdded;
+}
+
+int PairwiseStore::size()
+{
+    QMutexLocker locker(&mutex);
+    return entries.size();
+}
+
+bool PairwiseStore::compact(const QSet<QString> & liveKeys)
+{
+    QMutexLocker locker(&mutex);
+
+    QStringList keys;
+    for(auto key : fileKeys) if(liveKeys.contains(key)) keys << key;
+    if(numFileRecords - keys.size() <= keys.size()) return false;
+
+    // Written aside and renamed over the old file
+    QSaveFile file(filename);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Text)) return false;
+
+    QTextStream out(&file);
+    for(auto key : keys){
+        auto & result = entries[key];
+        out << toRecord(key, result["source"].toString(), result["target"].toString(), result) << "\n";
+    }
+    out.flush();
+    if(!file.commit()) return false;
+
+    fileKeys = QSet<QString>::fromList(keys);
+    numFileRecords = keys.size();
+    return true;
+}
+
+QString PairwiseStore::toRecord(QString key, QString source, QString target, const QVariantMap & result)
+{
+    QStringList matches;
+    for (auto p : result["matching_pairs"].value< QVector< QPair<QString, QString> > >())
+        matches << QString("%1,%2").arg(p.first).arg(p.second);
+
+    QStringList record;
+    record << key << source << target
+           << QString::number(result["min_cost"].toDouble(), 'g', 17)
+           << QString::number(result["isReversed"].toBool() ? 1 : 0)
+           << matches.join("|");
+
+    return record.join("\t");
+}
+
+bool PairwiseStore::fromRecord(QString line, QString & key, QVariantMap & result)
+{
+    auto item = line.split("\t");
+    if (item.size() != 6) return false;
+
+    QVector< QPair<QString, QString> > matching_pairs;
+    for (auto txtPair : item[5].split("|", QString::SkipEmptyParts)){
+        auto p = txtPair.split(",", QString::SkipEmptyParts);
+        if (p.size() != 2) continue;
+        matching_pairs << qMakePair(p.front(), p.back());
+    }
+
+    key = item[0];
+    result["source"].setValue(item[1]);
+    result["target"].setValue(item[2]);
+    result["min_cost"].setValue(item[3].toDouble());
+    result["isReversed"].setValue(item[4].toInt() != 0);
+    result["matching_pairs"].setValue(matching_pairs);
+
+    return true;
+}
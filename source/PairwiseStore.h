@@ -0,0 +1,55 @@
+#pragma once
+
+#include <QString>
+#include <QHash>
+#include <QSet>
+#include <QVariantMap>
+#include <QMutex>
+
+namespace Structure{ struct ShapeGraph; }
+
+// Persistent per-pair matching results keyed by the content of both shapes and the search options
+class PairwiseStore
+{
+public:
+    PairwiseStore(QString filename);
+
+    // Keys
+    static QString shapeHash(Structure::ShapeGraph * shape);
+    static QString optionsHash(const QVariantMap & options);
+    static QString pairKey(QString sourceHash, QString targetHash, QString optionsHash);
+
+    // Reads every stored result, later records override earlier ones
+    bool load();
+
+    // Reads results of another file without adding them to this one
+    bool loadFrom(QString otherFile);
+
+    // Appends results of another file missing from this one, returns how many were added
+    int merge(QString otherFile);
+
+    bool contains(QString key);
+    QVariantMap get(QString key);
+
+    // Records a result and appends it to the file right away, safe to call from any thread
+    void insert(QString key, QString source, QString target, const QVariantMap & result);
+
+    int size();
+
+    // Rewrites the file with only the given keys once superseded records outnumber them,
+    // results of other files read with loadFrom are not written. Returns whether it rewrote.
+    bool compact(const QSet<QString> & liveKeys);
+    QString fileName() const { return filename; }
+
+protected:
+    QString filename;
+    QHash<QString, QVariantMap> entries;
+
+    // Keys and number of records, repeated ones included, in this store's own file
+    QSet<QString> fileKeys;
+    int numFileRecords;
+    QMutex mutex;
+
+    static QString toRecord(QString key, QString source, QString target, const QVariantMap & result);
+    static bool fromRecord(QString line, QString & key, QVariantMap & result);
+};
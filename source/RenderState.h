@@ -0,0 +1,27 @@
+#pragma once
+
+#include <QColor>
+#include <QVector4D>
+#include <QMatrix4x4>
+
+namespace Structure{ struct Node; }
+namespace opengp{ namespace SurfaceMesh{ class SurfaceMeshModel; } }
+
+// Typed copy of the node properties read when drawing, so draw loops do no string lookups.
+// The model refreshes it when these properties change through its setters or invalidation.
+struct RenderState
+{
+    Structure::Node * node;
+    opengp::SurfaceMesh::SurfaceMeshModel * mesh;   // nullptr without a mesh
+    QColor color;
+    bool isHidden, isSmoothShading;
+    bool isInstance;
+    QMatrix4x4 instanceTransform;
+
+    RenderState() : node(nullptr), mesh(nullptr), isHidden(false), isSmoothShading(false), isInstance(false) {}
+
+    // Color, and in w: smooth shading 1, flat 0, hidden -1
+    QVector4D partColor() const {
+        return QVector4D(color.redF(), color.greenF(), color.blueF(), isHidden ? -1 : (isSmoothShading ? 1 : 0));
+    }
+};
@@ -0,0 +1,169 @@
+#include "SheetBuffers.h"
+#include "Viewer.h"
+
+#include <QColor>
+#include <QVector4D>
+#include <QSet>
+#include <QOpenGLShaderProgram>
+
+using namespace opengp;
+
+SheetBuffers::SheetBuffers()
+{
+
+}
+
+SheetBuffers::~SheetBuffers()
+{
+    clear();
+}
+
+void SheetBuffers::clear()
+{
+    // Buffers belong to the viewer's context
+    if(!viewer.isNull() && !entries.empty()){
+        viewer->makeCurrent();
+        for(auto entry : entries) entry->destroy();
+        viewer->doneCurrent();
+    }
+
+    entries.clear();
+}
+
+QVector<QVector3D> SheetBuffers::gridPoints(Structure::Sheet * sheet) const
+{
+    auto entry = entries.value(sheet);
+    return entry.isNull() ? QVector<QVector3D>() : entry->points;
+}
+
+int SheetBuffers::resolutionFor(Structure::Sheet * sheet, Viewer * glwidget)
+{
+    const int minResolution = 4, maxResolution = 64;
+    const double pixelsPerSegment = 8.0;
+
+    // Screen extent of the control points
+    double minX = 1e10, minY = 1e10, maxX = -1e10, maxY = -1e10;
+    for(auto p : sheet->controlPoints())
+    {
+        QVector4D q = glwidget->pvm * QVector4D(p[0], p[1], p[2], 1.0);
+        if(q.w() <= 0) return maxResolution;
+        minX = qMin(minX, double(q.x() / q.w())); maxX = qMax(maxX, double(q.x() / q.w()));
+        minY = qMin(minY, double(q.y() / q.w())); maxY = qMax(maxY, double(q.y() / q.w()));
+    }
+
+    double pixels = qMax((maxX - minX) * 0.5 * glwidget->width(), (maxY - minY) * 0.5 * glwidget->height());
+
+    // Powers of two keep zooming from rebuilding on every frame
+    int resolution = minResolution;
+    while(resolution < maxResolution && resolution * pixelsPerSegment < pixels) resolution *= 2;
+    return resolution;
+}
+
+void SheetBuffers::tessellate(Viewer * glwidget, Structure::Sheet * sheet, Entry & entry, int resolution)
+{
+    int n = resolution + 1;
+
+    // Grid positions on the surface
+    QVector<Vector3> grid(n * n);
+    for(int i = 0; i < n; i++)
+        for(int j = 0; j < n; j++)
+            grid[i * n + j] = sheet->position(Eigen::Vector4d(double(i) / resolution, double(j) / resolution, 0, 0));
+
+    // Normals from neighbouring grid points
+    QVector<GLfloat> vertices;
+    entry.points.clear();
+    for(int i = 0; i < n; i++)
+    {
+        for(int j = 0; j < n; j++)
+        {
+            Vector3 du = grid[qMin(i + 1, n - 1) * n + j] - grid[qMax(i - 1, 0) * n + j];
+            Vector3 dv = grid[i * n + qMin(j + 1, n - 1)] - grid[i * n + qMax(j - 1, 0)];
+            Vector3 normal = du.cross(dv);
+            normal = normal.norm() > 0 ? Vector3(normal.normalized()) : Vector3(0, 0, 1);
+
+            auto & p = grid[i * n + j];
+            for(int k = 0; k < 3; k++) vertices << p[k];
+            for(int k = 0; k < 3; k++) vertices << normal[k];
+            entry.points << QVector3D(p[0], p[1], p[2]);
+        }
+    }
+
+    QVector<GLuint> indices;
+    for(int i = 0; i < resolution; i++){
+        for(int j = 0; j < resolution; j++){
+            GLuint a = i * n + j, b = (i + 1) * n + j, c = (i + 1) * n + j + 1, d = i * n + j + 1;
+            indices << a << b << c << a << c << d;
+        }
+    }
+
+    if(!entry.vao.isCreated()) entry.vao.create();
+    entry.vao.bind();
+
+    if(!entry.vbo.isCreated()){
+        entry.vbo.setUsagePattern(QOpenGLBuffer::StaticDraw);
+        entry.vbo.create();
+    }
+    if(!entry.ibo.isCreated()){
+        entry.ibo.setUsagePattern(QOpenGLBuffer::StaticDraw);
+        entry.ibo.create();
+    }
+
+    entry.vbo.bind();
+    entry.vbo.allocate(vertices.constData(), vertices.size() * sizeof(GLfloat));
+
+    // Same locations as the "meshBatch" shader layout
+    glwidget->glEnableVertexAttribArray(0);
+    glwidget->glEnableVertexAttribArray(1);
+    glwidget->glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(GLfloat), (const void*)0);
+    glwidget->glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(GLfloat), (const void*)(3 * sizeof(GLfloat)));
+
+    entry.ibo.bind();
+    entry.ibo.allocate(indices.constData(), indices.size() * sizeof(GLuint));
+
+    entry.vao.release();
+    entry.vbo.release();
+    entry.ibo.release();
+
+    entry.numIndices = indices.size();
+    entry.resolution = resolution;
+    entry.controlPoints = sheet->controlPoints();
+}
+
+void SheetBuffers::draw(Viewer * glwidget, QOpenGLShaderProgram & program, const QVector<const RenderState*> & sheets)
+{
+    viewer = glwidget;
+
+    // Release sheets that got a mesh or were removed
+    QSet<Structure::Sheet*> drawn;
+    for(auto state : sheets) drawn << (Structure::Sheet*) state->node;
+    for(auto it = entries.begin(); it != entries.end();){
+        if(drawn.contains(it.key())){ ++it; continue; }
+        it.value()->destroy();
+        it = entries.erase(it);
+    }
+
+    if(sheets.empty()) return;
+
+    // Every grid vertex reads part index zero
+    program.setUniformValue(program.uniformLocation("partBase"), 0);
+    program.setUniformValue(program.uniformLocation("isInstanced"), 0);
+    glwidget->glVertexAttribI1i(2, 0);
+
+    for(auto state : sheets)
+    {
+        auto sheet = (Structure::Sheet*) state->node;
+        auto & entry = entries[sheet];
+        if(entry.isNull()) entry = QSharedPointer<Entry>(new Entry());
+
+        int resolution = resolutionFor(sheet, glwidget);
+        if(entry->resolution != resolution || entry->controlPoints != sheet->controlPoints())
+            tessellate(glwidget, sheet, *entry, resolution);
+
+        auto c = state->color;
+        program.setUniformValue(program.uniformLocation("partColor"), QVector4D(c.redF(), c.greenF(), c.blueF(), 1));
+
+        entry->vao.bind();
+        glwidget->glDrawElements(GL_TRIANGLES, entry->numIndices, GL_UNSIGNED_INT, (const void*)0);
+        entry->vao.release();
+    }
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <QHash>
+#include <QVector>
+#include <QVector3D>
+#include <QPointer>
+#include <QSharedPointer>
+#include <QOpenGLBuffer>
+#include <QOpenGLVertexArrayObject>
+
+#include "ShapeGraph.h"
+#include "RenderState.h"
+
+class Viewer;
+class QOpenGLShaderProgram;
+
+// Tessellated sheets that have no mesh yet, as indexed grids on the GPU. A grid is rebuilt only
+// when the sheet's control points change or when its size on screen asks for another resolution.
+class SheetBuffers
+{
+public:
+    SheetBuffers();
+    ~SheetBuffers();
+
+    // Draws sheet nodes with the bound "meshBatch" shader, buffers of sheets not given are released
+    void draw(Viewer * glwidget, QOpenGLShaderProgram & program, const QVector<const RenderState*> & sheets);
+
+    void clear();
+
+    // Grid vertices of a drawn sheet
+    QVector<QVector3D> gridPoints(Structure::Sheet * sheet) const;
+
+    // Grid segments per side for the sheet's projected size, in powers of two
+    static int resolutionFor(Structure::Sheet * sheet, Viewer * glwidget);
+
+protected:
+    struct Entry{
+        QOpenGLVertexArrayObject vao;
+        QOpenGLBuffer vbo, ibo;
+        int numIndices, resolution;
+        Array1D_Vector3 controlPoints;
+        QVector<QVector3D> points;
+
+        Entry() : vbo(QOpenGLBuffer::VertexBuffer), ibo(QOpenGLBuffer::IndexBuffer), numIndices(0), resolution(0) {}
+        void destroy(){ vao.destroy(); vbo.destroy(); ibo.destroy(); }
+    };
+
+    QHash< Structure::Sheet*, QSharedPointer<Entry> > entries;
+    QPointer<Viewer> viewer;
+
+    void tessellate(Viewer * glwidget, Structure::Sheet * sheet, Entry & entry, int resolution);
+};
@@ -202,10 +202,10 @@ void AutoBlend::doBlend()
             auto sourceName = selected[shapeI]->data.value("targetName").toString();
             auto targetName = selected[shapeJ]->data.value("targetName").toString();
 
+            // Held source stays loaded while the target is brought in
             auto cacheSource = document->cacheModel(sourceName);
             auto cacheTarget = document->cacheModel(targetName);
-
-            if(cacheSource == nullptr || cacheTarget == nullptr) continue;
+            if(cacheSource.isNull() || cacheTarget.isNull()) continue;
 
             auto source = QSharedPointer<Structure::Graph>(cacheSource->cloneAsShapeGraph());
 			auto target = QSharedPointer<Structure::Graph>(cacheTarget->cloneAsShapeGraph());
@@ -219,12 +219,9 @@ void AutoBlend::doBlend()
 
                 for(auto n : source->nodes)
                 {
-                    if (!document->datasetCorr[sourceName][n->id][targetName].empty())
+                    for(auto nj : document->datasetCorr.parts(sourceName, n->id, targetName))
                     {
-                        for(auto nj : document->datasetCorr[sourceName][n->id][targetName])
-                        {
-                            all_pairs << qMakePair(n->id, nj);
-                        }
+                        all_pairs << qMakePair(n->id, nj);
                     }
                 }
 
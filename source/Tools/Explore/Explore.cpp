@@ -77,8 +77,7 @@ void Explore::init()
                 {
                     auto s = catModels[i], t = catModels[j];
 
-                    double dist = std::max(document->datasetMatching[s][t]["min_cost"].toDouble(),
-                                           document->datasetMatching[t][s]["min_cost"].toDouble());
+                    double dist = std::max(document->matchingCost(s, t), document->matchingCost(t, s));
 
                     distMat[i][j] = distMat[j][i] = dist;
                 }
@@ -11,6 +11,7 @@
 #include <QOpenGLFunctions>
 
 #include "ExploreProcess.h"
+#include "MeshLOD.h"
 
 ExploreLiveView::ExploreLiveView(QGraphicsItem *parent, Document *document) : QGraphicsObject(parent),
     document(document), isReady(false), isCacheImage(false), cacheImageSize(512)
@@ -48,6 +49,12 @@ void ExploreLiveView::showBlend(QVariantMap info)
         this->isCacheImage = true;
         this->cachedImage = QImage();
     }
+    else
+    {
+        // Drawn every frame into a small view, coarser triangles look the same
+        for (auto & mesh : meshes)
+            if (!mesh.isPoints) MeshLOD::simplifySoup(mesh.points, mesh.normals, MeshLOD::thumbnailCells);
+    }
 
     this->isReady = true;
 }
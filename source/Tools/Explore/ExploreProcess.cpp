@@ -7,6 +7,7 @@
 #include "DivergingColorMaps.hpp"
 
 #include "SimpleMatrix.h"
+#include "MeshLOD.h"
 
 #include "voronoi.hpp"
 using namespace cinekine;
@@ -53,9 +54,27 @@ QPair<QVector3D,QMatrix4x4> ExploreProcess::defaultCamera(double zoomFactor, int
 }
 
 // From surface mesh to basic mesh
-Thumbnail::QBasicMesh ExploreProcess::toBasicMesh (opengp::SurfaceMesh::SurfaceMeshModel * m, QColor color)
+Thumbnail::QBasicMesh ExploreProcess::toBasicMesh (opengp::SurfaceMesh::SurfaceMeshModel * m, QColor color, int lodCells)
 {
     Thumbnail::QBasicMesh mesh;
+
+    // Simplified by vertex clustering, with normals of the new triangles
+    if (lodCells > 0){
+        auto points = m->vertex_coordinates();
+        auto triangles = MeshLOD::clusterTriangles(m, lodCells);
+        for (size_t i = 0; i + 2 < triangles.size(); i += 3){
+            QVector3D fp[3];
+            for (int k = 0; k < 3; k++){
+                auto p = points[opengp::SurfaceMesh::SurfaceMeshModel::Vertex(triangles[i + k])];
+                fp[k] = QVector3D(p[0], p[1], p[2]);
+            }
+            auto n = QVector3D::normal(fp[0], fp[1], fp[2]);
+            mesh.addTri(fp[0], fp[1], fp[2], n, n, n);
+        }
+        mesh.color = color;
+        return mesh;
+    }
+
     m->update_face_normals();
     for (auto f : m->faces()){
         QVector<QVector3D> fp, fn;
@@ -103,10 +122,11 @@ Thumbnail * ExploreProcess::makeThumbnail(QGraphicsItem * parent, Document * doc
     t->setProperty("isNoBackground", true);
     t->setProperty("isNoBorder", true);
 
-    // Add parts of target shape
+    // Add parts of target shape, small thumbnails use a simplified mesh
     auto m = document->cacheModel(s);
+    int lodCells = hqRendering ? 0 : MeshLOD::thumbnailCells;
     for (auto n : m->nodes){
-        t->addAuxMesh(toBasicMesh(m->getMesh(n->id), n->vis_property["color"].value<QColor>()));
+        t->addAuxMesh(toBasicMesh(m->getMesh(n->id), n->vis_property["color"].value<QColor>(), lodCells));
     }
 
     t->setPos(pos - QPointF(defaultWidth * 0.5, defaultWidth * 0.5));
@@ -206,9 +226,10 @@ void ExploreProcess::BlendPath::prepare(Document *document)
 {
     if(isReady) return;
 
+    // Held source stays loaded while the target is brought in
     auto cacheSource = document->cacheModel(source);
     auto cacheTarget = document->cacheModel(target);
-    if(cacheSource == nullptr || cacheTarget == nullptr) return;
+    if(cacheSource.isNull() || cacheTarget.isNull()) return;
 
     auto sourceShape = QSharedPointer<Structure::Graph>(cacheSource->cloneAsShapeGraph());
     auto targetShape = QSharedPointer<Structure::Graph>(cacheTarget->cloneAsShapeGraph());
@@ -221,12 +242,9 @@ void ExploreProcess::BlendPath::prepare(Document *document)
 
         for(auto n : sourceShape->nodes)
         {
-            if (!document->datasetCorr[source][n->id][target].empty())
+            for(auto nj : document->datasetCorr.parts(source, n->id, target))
             {
-                for(auto nj : document->datasetCorr[source][n->id][target])
-                {
-                    all_pairs << qMakePair(n->id, nj);
-                }
+                all_pairs << qMakePair(n->id, nj);
             }
         }
 
@@ -19,7 +19,7 @@ class SynthesisManager;
 
 namespace ExploreProcess{
     QPair<QVector3D, QMatrix4x4> defaultCamera(double zoomFactor, int width = 128, int height = 128);
-    Thumbnail::QBasicMesh toBasicMesh (opengp::SurfaceMesh::SurfaceMeshModel * m, QColor color);
+    Thumbnail::QBasicMesh toBasicMesh (opengp::SurfaceMesh::SurfaceMeshModel * m, QColor color, int lodCells = 0);
     QColor qtJetColor (double v, double vmin = 0.0, double vmax = 1.0);
     Thumbnail * makeThumbnail(QGraphicsItem * parent, Document * document, QString s, QPointF pos, bool hqRendering);
     QPolygonF embed(QMap<int, QMap<int, double > > distMatrix, int embedOption);
@@ -53,10 +53,11 @@ void ManualBlendManager::doBlend(QString source_part_name, QString target_name,
 			for (auto id : group){
 				sids << id;
 
-				if (document->datasetCorr[sourceName][id][targetName].empty()){
+				auto matches = document->datasetCorr.parts(sourceName, id, targetName);
+				if (matches.empty()){
 					gcorr->setNonCorresSource(id);
 				} else {
-					auto tid = document->datasetCorr[sourceName][id][targetName].front();
+					auto tid = matches.front();
 					if (!tids.contains(tid))
 						tids << tid;
 				}
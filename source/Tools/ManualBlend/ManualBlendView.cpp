@@ -260,7 +260,7 @@ void ManualBlendView::suggestParts(QPointF galleryPos)
 
     QString sourceName = document->firstModelName();
 	QString sourcePart = model->activeNode->id;
-    if (document->datasetCorr[sourceName][sourcePart].empty()){
+    if (!document->datasetCorr.hasMatch(sourceName, sourcePart)){
 		((GraphicsScene*)scene())->displayMessage("No correspondence found", 500);
 		return;
 	}
@@ -345,11 +345,11 @@ void ManualBlendView::suggestParts(QPointF galleryPos)
 		return mesh;
 	};
 
-    for (auto targetName : document->datasetCorr[sourceName][sourcePart].keys())
+    for (auto targetName : document->datasetCorr.targets(sourceName, sourcePart))
 	{
 		auto targetModel = document->cacheModel(targetName);
 
-        for (auto targetPartName : document->datasetCorr[sourceName][sourcePart][targetName])
+        for (auto targetPartName : document->datasetCorr.parts(sourceName, sourcePart, targetName))
 		{
 			auto data = sharedData;
 
@@ -444,12 +444,12 @@ void ManualBlendView::cloudReceived(QPair< QVector<Eigen::Vector3f>, QVector<Eig
 
     // Check if blending is canceld
     if(cloud.first.empty()){
-        n->vis_property["isHidden"].setValue(false);
+        source->setVisProperty(n, "isHidden", false);
 
         // remaining elements of a group
         for(auto nj : source->nodes){
             if(nj == n || !source->shareGroup(nj->id, n->id)) continue;
-            nj->vis_property["isHidden"].setValue(false);
+            source->setVisProperty(nj, "isHidden", false);
         }
         return;
     }
@@ -457,12 +457,12 @@ void ManualBlendView::cloudReceived(QPair< QVector<Eigen::Vector3f>, QVector<Eig
 	for (auto p : cloud.first) cloudPoints << QVector3D(p[0],p[1],p[2]);
 	for (auto p : cloud.second) cloudNormals << QVector3D(p[0], p[1], p[2]);
 
-	n->vis_property["isHidden"].setValue(true);
+	source->setVisProperty(n, "isHidden", true);
 	cloudColor = n->vis_property["color"].value<QColor>();
 
     // remaining elements of a group
     for(auto nj : source->nodes){
         if(nj == n || !source->shareGroup(nj->id, n->id)) continue;
-        nj->vis_property["isHidden"].setValue(true);
+        source->setVisProperty(nj, "isHidden", true);
     }
 }
@@ -4,6 +4,7 @@
 #include <QGraphicsSceneMouseEvent>
 
 #include "Model.h"
+#include "ModelHistory.h"
 #include "SketchView.h"
 #include "GeometryHelper.h"
 #include "Camera.h"
@@ -222,7 +223,10 @@ void SketchManipulatorTool::mouseMoveEvent(QGraphicsSceneMouseEvent * event)
 
 void SketchManipulatorTool::mousePressEvent(QGraphicsSceneMouseEvent * event)
 {
-	if (model != nullptr) model->storeActiveNodeGeometry();
+	if (model != nullptr){
+		model->undoHistory()->record("Transform");
+		model->storeActiveNodeGeometry();
+	}
 
     if (event->buttons() & Qt::LeftButton) leftButtonDown = true;
     if (event->buttons() & Qt::RightButton) rightButtonDown = true;
@@ -77,12 +77,14 @@ leftButtonDown(false), rightButtonDown(false), middleButtonDown(false), document
     QSettings s;
     options["lightBackColor"].setValue(s.value("lightBackColor").value<QColor>());
     options["darkBackColor"].setValue(s.value("darkBackColor").value<QColor>());
+    options["showRenderStats"].setValue(s.value("showRenderStats", false).toBool());
 
     // Global settings
     connect(document, &Document::globalSettingsChanged, [&](){
         QSettings s;
         options["lightBackColor"].setValue(s.value("lightBackColor").value<QColor>());
         options["darkBackColor"].setValue(s.value("darkBackColor").value<QColor>());
+        options["showRenderStats"].setValue(s.value("showRenderStats", false).toBool());
         scene()->update(sceneBoundingRect());
     });
 }
@@ -275,6 +277,16 @@ void SketchView::postPaint(QPainter * painter, QWidget *)
         painter->drawText(QPointF(10, rect.height()-20), SketchViewOpName[sketchOp]);
     }
 
+    // Culling and level of detail counts
+    if(options["showRenderStats"].toBool())
+    {
+        auto model = document->getModel(document->firstModelName());
+        if(model != nullptr){
+            painter->setPen(QPen(Qt::white));
+            painter->drawText(QPointF(10, 36), model->renderStats());
+        }
+    }
+
 	// Messages
     if(false)
     {
@@ -629,6 +641,10 @@ void SketchView::keyPressEvent(QKeyEvent *event)
         setSketchOp(SKETCH_CURVE);
     }
 
+    // Undo and redo
+    if(event->matches(QKeySequence::Undo)) document->undo(document->firstModelName());
+    if(event->matches(QKeySequence::Redo)) document->redo(document->firstModelName());
+
     if(event->key() == Qt::Key_S) setSketchOp(SKETCH_CURVE);
     if(event->key() == Qt::Key_M) setSketchOp(TRANSFORM_PART);
     if(event->key() == Qt::Key_D) setSketchOp(DEFORM_SKETCH);
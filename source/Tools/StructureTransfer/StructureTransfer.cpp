@@ -87,9 +87,11 @@ void StructureTransfer::init()
 
 				bool isGood = false;
 
+				sourceModel->detachMeshes();
+
 				for (auto n : sourceModel->nodes)
 				{
-					auto m = sourceModel->getMesh(n->id);
+					auto m = Model::detachMesh(n);
 
 					QTemporaryFile file("XXXXXX.obj");
 
@@ -115,6 +117,8 @@ void StructureTransfer::init()
 					}
 				}
 
+				sourceModel->invalidateGeometry();
+
 				((GraphicsScene*)scene())->displayMessage(QString("External mesher done. OK = %1").arg(isGood));
 
 				qApp->restoreOverrideCursor();
@@ -122,13 +126,16 @@ void StructureTransfer::init()
 				return;
 			}
 
+			sourceModel->detachMeshes();
+
 			for (auto n : sourceModel->nodes)
 			{
-				auto m = sourceModel->getMesh(n->id);
+				auto m = Model::detachMesh(n);
 
 				Remesh::IsotropicRemesher mesher(m);
 				mesher.apply();
 			}
+			sourceModel->invalidateGeometry();
 		});
 		
         connect(document, &Document::categoryAnalysisDone, [=](){
@@ -222,9 +229,12 @@ void StructureTransfer::thumbnailSelected(Thumbnail * t)
 	else
 		sourceModel->setAllControlPoints(sourceModel->ShapeGraph::property["origPoints"].value<Array2D_Vector3>());
 
+    // Meshes are deformed in place
+    sourceModel->detachMeshes();
+
     ShapeGeometry::encodeGeometry(sourceModel);
 
-    if(document->datasetCorr.contains(sourceName))
+    if(document->datasetCorr.containsShape(sourceName))
     {
         auto shapeA = QSharedPointer<Structure::ShapeGraph>(new Structure::ShapeGraph(*sourceModel));
         auto shapeB = QSharedPointer<Structure::ShapeGraph>(new Structure::ShapeGraph(*targetModel));
@@ -234,16 +244,17 @@ void StructureTransfer::thumbnailSelected(Thumbnail * t)
 
         for (auto n : sourceModel->nodes)
         {
-            n->vis_property["isHidden"].setValue(false);
+            sourceModel->setVisProperty(n, "isHidden", false);
 
-            if(document->datasetCorr[sourceName][n->id].contains(targetName))
+            auto matches = document->datasetCorr.parts(sourceName, n->id, targetName);
+            if(!matches.empty())
             {
                 la << n->id;
-                lb << document->datasetCorr[sourceName][n->id][targetName].front();
+                lb << matches.front();
             }
             else
             {
-                n->vis_property["isHidden"].setValue(true);
+                sourceModel->setVisProperty(n, "isHidden", true);
             }
         }
 
@@ -320,6 +331,7 @@ void StructureTransfer::thumbnailSelected(Thumbnail * t)
     }
 
     ShapeGeometry::decodeGeometry(sourceModel);
+    sourceModel->invalidateGeometry();
 
 	scene()->update(sceneBoundingRect());
 }
@@ -0,0 +1,12 @@
+TARGET      = TopoBlenderBatch
+TEMPLATE    = app
+DESTDIR     = $$PWD/../bin
+
+CONFIG(debug, debug|release) {TARGET = TopoBlenderBatchD}
+
+CONFIG     += console
+CONFIG     -= app_bundle
+
+include(TopoBlenderCommon.pri)
+
+SOURCES +=  batch.cpp
@@ -0,0 +1,101 @@
+# Shared by the GUI and the batch tool: document, analysis, models, and libraries
+
+QT          += core gui opengl widgets xml
+
+INCLUDEPATH += $$PWD $$PWD/external
+
+SOURCES +=  $$PWD/Document.cpp \
+            $$PWD/DocumentAnalyzeWorker.cpp \
+            $$PWD/CorrespondenceEngine.cpp \
+            $$PWD/PairwiseStore.cpp \
+            $$PWD/CorrespondenceIndex.cpp \
+            $$PWD/CorrespondenceFile.cpp \
+            $$PWD/ModelCache.cpp \
+            $$PWD/ModelPrefetcher.cpp \
+            $$PWD/Model.cpp \
+            $$PWD/ModelMesher.cpp \
+            $$PWD/MeshBVH.cpp \
+            $$PWD/MeshBuffers.cpp \
+            $$PWD/SheetBuffers.cpp \
+            $$PWD/MeshLOD.cpp \
+            $$PWD/ModelHistory.cpp \
+            $$PWD/Viewer.cpp
+
+HEADERS +=  $$PWD/GeometryHelper.h \
+            $$PWD/Viewer.h \
+            $$PWD/Camera.h \
+            $$PWD/Document.h \
+            $$PWD/DocumentAnalyzeWorker.h \
+            $$PWD/CorrespondenceEngine.h \
+            $$PWD/PairwiseStore.h \
+            $$PWD/CorrespondenceIndex.h \
+            $$PWD/CorrespondenceFile.h \
+            $$PWD/ModelCache.h \
+            $$PWD/ModelPrefetcher.h \
+            $$PWD/Model.h \
+            $$PWD/ModelMesher.h \
+            $$PWD/MeshBVH.h \
+            $$PWD/MeshBuffers.h \
+            $$PWD/SheetBuffers.h \
+            $$PWD/RenderState.h \
+            $$PWD/MeshLOD.h \
+            $$PWD/ModelHistory.h
+
+win32{
+    # Eigen 3.2.5 introduced some new warnings
+    QMAKE_CXXFLAGS *= /wd4522
+
+    # Use native OpenGL drivers with Qt5.5
+    # No longer implicit since the ANGLE driver is now an alternative
+    LIBS += -lopengl32 -lglu32
+
+    # Enable debuging in release mode
+    QMAKE_CXXFLAGS_RELEASE += /Zi
+    QMAKE_LFLAGS_RELEASE += /DEBUG
+}
+
+linux-g++{ LIBS += -lGLU }
+
+# C++11 support on linux
+linux-g++{ CONFIG += c++11 warn_off }
+
+# OpenMP
+win32{
+    QMAKE_CXXFLAGS *= /openmp
+}
+unix:!mac{
+    QMAKE_CXXFLAGS *= -fopenmp
+    LIBS += -lgomp
+}
+
+### GeoTopo Libraries
+
+# Build flag
+CONFIG(debug, debug|release) {CFG = debug} else {CFG = release}
+
+# GeoTopo library
+LIBS += -L$$PWD/../../GeoTopo/source/GeoTopoLib/lib/$$CFG -lGeoTopoLib
+INCLUDEPATH += $$PWD/../../GeoTopo/source/GeoTopoLib
+
+# StructureGraph library
+LIBS += -L$$PWD/../../GeoTopo/source/StructureGraphLib/lib/$$CFG -lStructureGraphLib
+INCLUDEPATH += $$PWD/../../GeoTopo/source/StructureGraphLib
+
+# Surface Reconstruction library
+LIBS += -L$$PWD/../../GeoTopo/source/Reconstruction/lib/$$CFG -lReconstruction
+INCLUDEPATH += $$PWD/../../GeoTopo/source/Reconstruction
+
+# Surface mesh library
+LIBS += -L$$PWD/../../GeoTopo/source/external/SurfaceMesh/lib/$$CFG -lSurfaceMesh
+INCLUDEPATH += $$PWD/../../GeoTopo/source/external/SurfaceMesh $$PWD/../../GeoTopo/source/external/SurfaceMesh/surface_mesh
+
+# NURBS library
+LIBS += -L$$PWD/../../GeoTopo/source/NURBS/lib/$$CFG -lNURBS
+INCLUDEPATH += $$PWD/../../GeoTopo/source/NURBS
+
+### Other libraries
+# SDF library
+INCLUDEPATH += $$PWD/external/SDFGen
+
+# Embree
+LIBS += -L$$PWD/Tools/Explore
@@ -0,0 +1,82 @@
+TARGET      = TopoBlender
+TEMPLATE    = app
+DESTDIR     = $$PWD/../bin
+
+CONFIG(debug, debug|release) {TARGET = TopoBlenderD}
+
+include(TopoBlenderCommon.pri)
+
+SOURCES +=  main.cpp\
+            mainwindow.cpp \
+            GraphicsView.cpp \
+            GraphicsScene.cpp \
+            ModifiersPanel.cpp \
+            Tool.cpp \
+            ModelConnector.cpp \
+            Thumbnail.cpp \
+            Gallery.cpp \
+# Sketch tool
+            Tools/Sketch/Sketch.cpp \
+            Tools/Sketch/SketchView.cpp \
+            Tools/Sketch/SketchManipulatorTool.cpp \
+            Tools/Sketch/SketchDuplicate.cpp \
+# Manual blend tool
+            Tools/ManualBlend/ManualBlend.cpp \
+            Tools/ManualBlend/ManualBlendView.cpp \
+            Tools/ManualBlend/ManualBlendManager.cpp \
+# Auto blend tool
+            Tools/AutoBlend/AutoBlend.cpp \
+# Structure transfer tool
+            Tools/StructureTransfer/StructureTransfer.cpp \
+            Tools/StructureTransfer/StructureTransferView.cpp \
+# Explore tool
+            Tools/Explore/Explore.cpp \
+            Tools/Explore/ExploreProcess.cpp \
+            Tools/Explore/ExploreLiveView.cpp \
+            ResolveCorrespondence.cpp
+
+HEADERS  += mainwindow.h \
+            GraphicsView.h \
+            GraphicsScene.h \
+            ModifiersPanel.h \
+            Tool.h \
+            ModelConnector.h \
+            Thumbnail.h \
+            Gallery.h \
+# Sketch tool
+            Tools/Sketch/Sketch.h \
+            Tools/Sketch/SketchView.h \
+            Tools/Sketch/SketchManipulatorTool.h \
+            Tools/Sketch/SketchDuplicate.h \
+# Manual blend tool
+            Tools/ManualBlend/ManualBlend.h \
+            Tools/ManualBlend/ManualBlendView.h \
+            Tools/ManualBlend/ManualBlendManager.h \
+# Auto blend tool
+            Tools/AutoBlend/AutoBlend.h \
+# Structure transfer tool
+            Tools/StructureTransfer/StructureTransfer.h \
+            Tools/StructureTransfer/StructureTransferView.h \
+# Explore tool
+            Tools/Explore/Explore.h \
+            Tools/Explore/ExploreProcess.h \
+            Tools/Explore/ExploreLiveView.h \
+            ResolveCorrespondence.h
+
+# Qt UI files
+FORMS    += mainwindow.ui \
+            ModifiersPanel.ui \
+# Sketch tool
+            Tools/Sketch/Sketch.ui \
+            Tools/Sketch/SketchDuplicate.ui \
+# Manual blend tool
+            Tools/ManualBlend/ManualBlend.ui \
+# Auto blend tool
+            Tools/AutoBlend/AutoBlend.ui \
+# Structure transfer tool
+            Tools/StructureTransfer/StructureTransfer.ui \
+# Explore tool
+            Tools/Explore/Explore.ui
+
+RESOURCES += media/TopoBlender.qrc
+win32:RC_FILE = media/TopoBlender.rc
@@ -1,4 +1,5 @@
 #include "Viewer.h"
+#include "MeshBuffers.h"
 
 #include <QOpenGLShaderProgram>
 #include <QOpenGLTexture>
@@ -219,6 +220,68 @@ void Viewer::initializeGL()
 
         shaders.insert("mesh", program);
     }
+
+    // Batched model parts, see MeshBuffers
+    {
+        auto program = new QOpenGLShaderProgram (context());
+        program->addShaderFromSourceCode(QOpenGLShader::Vertex,
+            "#version 330 core\n"
+            "layout (location = 0) in vec3 vertex;\n"
+            "layout (location = 1) in vec3 normal;\n"
+            "layout (location = 2) in int part;\n"
+            "layout (location = 3) in mat4 instanceMatrix;\n"
+            "layout (location = 7) in vec4 instanceColor;\n"
+            "uniform mat4 matrix;\n"
+            "uniform int partBase;\n"
+            "uniform vec4 partColor[" + QByteArray::number(MeshBuffers::maxPartsPerDraw) + "];\n"
+            "uniform int isInstanced;\n"
+            "out vec3 FragPos;\n"
+            "out vec3 Normal;\n"
+            "out vec3 Color;\n"
+            "flat out int Smooth;\n"
+            "void main(void)\n"
+            "{\n"
+            "   vec4 c = (isInstanced != 0) ? instanceColor : partColor[part - partBase];\n"
+            "   mat4 m = (isInstanced != 0) ? instanceMatrix : mat4(1.0);\n"
+            "   vec4 p = m * vec4(vertex, 1.0);\n"
+            "   // Hidden parts collapse outside the clip volume\n"
+            "   gl_Position = (c.w < 0.0) ? vec4(2.0, 2.0, 2.0, 1.0) : matrix * p;\n"
+            "   FragPos = p.xyz;\n"
+            "   // Instances are moved, rotated, or mirrored, their linear part also maps normals\n"
+            "   Normal = mat3(m) * normal;\n"
+            "   Color = c.xyz;\n"
+            "   Smooth = int(c.w > 0.5);\n"
+            "}");
+        program->addShaderFromSourceCode(QOpenGLShader::Fragment,
+            "#version 330 core\n"
+            "out vec4 color;\n"
+            "in vec3 FragPos;\n"
+            "in vec3 Normal;\n"
+            "in vec3 Color;\n"
+            "flat in int Smooth;\n"
+            "uniform vec3 lightPos;\n"
+            "uniform vec3 viewPos;\n"
+            "uniform vec3 lightColor;\n"
+            "void main(void)\n"
+            "{\n"
+            "    // Vertices are shared, flat shading takes the face normal from screen derivatives \n"
+            "    vec3 norm = (Smooth != 0) ? normalize(Normal) : normalize(cross(dFdx(FragPos), dFdy(FragPos))); \n"
+            "    \n"
+            "    vec3 ambient = 0.2f * lightColor; \n"
+            "    vec3 lightDir = normalize(lightPos - FragPos); \n"
+            "    vec3 diffuse = max(dot(norm, lightDir), 0.0) * lightColor; \n"
+            "    \n"
+            "    vec3 fakeLightDir = normalize(vec3(0.5,0.5,1));\n"
+            "    vec3 viewDir = normalize(viewPos - FragPos); \n"
+            "    vec3 reflectDir = reflect(-fakeLightDir, norm);  \n"
+            "    vec3 specular = pow(max(dot(viewDir, reflectDir), 0.0), 64) * lightColor; \n"
+            "    \n"
+            "    color = vec4((ambient + diffuse + specular) * Color, 1.0); \n"
+            "}");
+        program->link();
+
+        shaders.insert("meshBatch", program);
+    }
 }
 
 void Viewer::drawPoints(const QVector< QVector3D > & points, QColor color, QMatrix4x4 camera, bool isConnected)
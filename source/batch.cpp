@@ -0,0 +1,248 @@
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QMutex>
+#include <QElapsedTimer>
+#include <iostream>
+#include <random>
+
+#include "Document.h"
+#include "DocumentAnalyzeWorker.h"
+#include "Model.h"
+#include "MeshBVH.h"
+#include "ModelMesher.h"
+
+// Ray picking through the hierarchy against testing every triangle
+static int benchPicking(Document & document, QString shape, int numRays)
+{
+    auto model = document.cacheModel(shape);
+    if(model.isNull()){
+        std::cerr << "Could not load shape: " << qPrintable(shape) << std::endl;
+        return 1;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    auto tree = model->pickingBVH();
+    double buildTime = timer.nsecsElapsed() * 1e-6;
+
+    // Rays from a sphere around the shape towards points inside its box
+    auto box = model->robustBBox();
+    double radius = box.diagonal().norm();
+    std::mt19937 rng(0);
+    std::uniform_real_distribution<double> uniform(-1.0, 1.0);
+
+    QVector<QVector3D> origins, directions;
+    for(int i = 0; i < numRays; i++){
+        Eigen::Vector3d d(uniform(rng), uniform(rng), uniform(rng));
+        if(d.norm() < 1e-6) d = Eigen::Vector3d(0,0,1);
+        Eigen::Vector3d target = box.center() + 0.5 * box.diagonal().cwiseProduct(Eigen::Vector3d(uniform(rng), uniform(rng), uniform(rng)));
+        Eigen::Vector3d origin = box.center() + d.normalized() * radius;
+        Eigen::Vector3d direction = (target - origin).normalized();
+        origins << QVector3D(origin[0], origin[1], origin[2]);
+        directions << QVector3D(direction[0], direction[1], direction[2]);
+    }
+
+    QStringList bruteParts, bvhParts;
+
+    timer.restart();
+    for(int i = 0; i < numRays; i++) bruteParts << model->pickPartBruteForce(origins[i], directions[i]);
+    double bruteTime = timer.nsecsElapsed() * 1e-6;
+
+    timer.restart();
+    for(int i = 0; i < numRays; i++) bvhParts << model->pickPart(origins[i], directions[i]);
+    double bvhTime = timer.nsecsElapsed() * 1e-6;
+
+    int numSame = 0, numHits = 0;
+    for(int i = 0; i < numRays; i++){
+        if(bruteParts[i] == bvhParts[i]) numSame++;
+        if(!bvhParts[i].isEmpty()) numHits++;
+    }
+
+    std::cout << qPrintable(shape) << ": " << tree->numTriangles() << " triangles, " << numRays << " rays, " << numHits << " hits" << std::endl;
+    std::cout << "  build       " << buildTime << " ms" << std::endl;
+    std::cout << "  brute force " << bruteTime / numRays << " ms/ray" << std::endl;
+    std::cout << "  hierarchy   " << bvhTime / numRays << " ms/ray (" << bruteTime / std::max(bvhTime, 1e-9) << "x)" << std::endl;
+    std::cout << "  same part   " << numSame << " of " << numRays << std::endl;
+
+    return 0;
+}
+
+// Distance field of a whole shape, single threaded against parallel
+static int benchLevelSet(Document & document, QString shape, double dx)
+{
+    auto model = document.cacheModel(shape);
+    if(model.isNull()){
+        std::cerr << "Could not load shape: " << qPrintable(shape) << std::endl;
+        return 1;
+    }
+
+    std::cout << qPrintable(shape) << ": ";
+    for(auto line : ModelMesher::benchmarkLevelSet(model.data(), dx))
+        std::cout << qPrintable(line) << std::endl;
+
+    return 0;
+}
+
+// Marching cubes on analytic volumes, needs no dataset
+static int benchMarch(int gridSize)
+{
+    for(auto line : ModelMesher::benchmarkMarch(gridSize))
+        std::cout << qPrintable(line) << std::endl;
+
+    return 0;
+}
+
+// Dataset analysis without a display, for example:
+//   TopoBlenderBatch --dataset /data/shapes --category chairs --pairwise --workers 16
+//   TopoBlenderBatch --dataset /data/shapes --category chairs --analyze --source chair01
+// All pairs can be split over processes and merged once every shard is done:
+//   TopoBlenderBatch --dataset /data/shapes --category chairs --pairwise --shard 3/8
+//   TopoBlenderBatch --dataset /data/shapes --category chairs --pairwise --merge
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+
+    // Same settings as the interactive application
+    QCoreApplication::setOrganizationName("TopoBlender");
+    QCoreApplication::setOrganizationDomain("github.com/ialhashim/TopoBlender");
+    QCoreApplication::setApplicationName("TopoBlender");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("TopoBlender dataset analysis");
+    parser.addHelpOption();
+
+    QCommandLineOption datasetOption(QStringList() << "d" << "dataset", "Dataset folder.", "folder");
+    QCommandLineOption categoryOption(QStringList() << "c" << "category", "Category to process, the first one by default.", "name");
+    QCommandLineOption workersOption(QStringList() << "w" << "workers", "Concurrent jobs, all cores by default.", "n", "-1");
+    QCommandLineOption cacheOption("cache-mb", "Memory budget for loaded shapes in MB, 0 for unlimited.", "mb");
+    QCommandLineOption pairwiseOption("pairwise", "Compute matchings between all pairs of the category.");
+    QCommandLineOption analyzeOption("analyze", "Compute correspondence of the category to a source shape.");
+    QCommandLineOption sourceOption(QStringList() << "s" << "source", "Source shape of --analyze, the first of the category by default.", "shape");
+    QCommandLineOption listOption("list", "List the categories of the dataset.");
+    QCommandLineOption shardOption("shard", "Compute only shard i of n of --pairwise, i counts from 0.", "i/n");
+    QCommandLineOption shardHashOption("shard-by-hash", "Split pairs by a hash of their names instead of index ranges.");
+    QCommandLineOption mergeOption("merge", "Merge finished shards of --pairwise into the result files.");
+    QCommandLineOption benchPickingOption("bench-picking", "Time ray picking on a shape of the dataset.", "shape");
+    QCommandLineOption raysOption("rays", "Number of rays of --bench-picking.", "n", "1000");
+    QCommandLineOption benchLevelSetOption("bench-levelset", "Time the distance field used for offset surfaces on a shape of the dataset.", "shape");
+    QCommandLineOption voxelOption("voxel", "Grid spacing of --bench-levelset.", "size", "0.015");
+    QCommandLineOption benchMarchOption("bench-march", "Time marching cubes on volumes of the given grid size.", "size");
+
+    parser.addOptions(QList<QCommandLineOption>() << datasetOption << categoryOption << workersOption << cacheOption
+                      << pairwiseOption << analyzeOption << sourceOption << listOption
+                      << shardOption << shardHashOption << mergeOption
+                      << benchPickingOption << raysOption << benchLevelSetOption << voxelOption
+                      << benchMarchOption);
+    parser.process(a);
+
+    if(parser.isSet(benchMarchOption))
+        return benchMarch(parser.value(benchMarchOption).toInt());
+
+    if(!parser.isSet(datasetOption)){
+        std::cerr << "No dataset folder given." << std::endl;
+        parser.showHelp(1);
+    }
+
+    Document document;
+
+    if(parser.isSet(cacheOption))
+        document.cachedModels.setBudget(size_t(parser.value(cacheOption).toULongLong()) * 1024 * 1024);
+
+    if(!document.loadDataset(parser.value(datasetOption))){
+        std::cerr << "Could not load dataset: " << qPrintable(parser.value(datasetOption)) << std::endl;
+        return 1;
+    }
+
+    if(parser.isSet(listOption)){
+        for(auto cat : document.categories.keys())
+            std::cout << qPrintable(cat) << "\t" << document.categories.value(cat).toStringList().size() << std::endl;
+        return 0;
+    }
+
+    if(parser.isSet(benchPickingOption))
+        return benchPicking(document, parser.value(benchPickingOption), parser.value(raysOption).toInt());
+
+    if(parser.isSet(benchLevelSetOption))
+        return benchLevelSet(document, parser.value(benchLevelSetOption), parser.value(voxelOption).toDouble());
+
+    if(parser.isSet(categoryOption)) document.currentCategory = parser.value(categoryOption);
+    if(!document.categories.contains(document.currentCategory)){
+        std::cerr << "No such category: " << qPrintable(document.currentCategory) << std::endl;
+        return 1;
+    }
+
+    auto catModels = document.categories.value(document.currentCategory).toStringList();
+    if(catModels.empty()){
+        std::cerr << "Category has no shapes: " << qPrintable(document.currentCategory) << std::endl;
+        return 1;
+    }
+
+    if(!parser.isSet(pairwiseOption) && !parser.isSet(analyzeOption)){
+        std::cerr << "Nothing to do, use --pairwise or --analyze." << std::endl;
+        return 1;
+    }
+
+    DocumentAnalyzeWorker worker(&document, parser.value(workersOption).toInt());
+
+    if(parser.isSet(shardOption))
+    {
+        QStringList shard = parser.value(shardOption).split("/");
+        worker.shardIndex = shard.front().toInt();
+        worker.numShards = shard.back().toInt();
+        if(shard.size() != 2 || worker.numShards < 1 || worker.shardIndex < 0 || worker.shardIndex >= worker.numShards){
+            std::cerr << "Shard should be i/n with 0 <= i < n." << std::endl;
+            return 1;
+        }
+    }
+    worker.isShardByHash = parser.isSet(shardHashOption);
+    worker.isMergeShards = parser.isSet(mergeOption);
+
+    // Progress is reported from worker threads
+    QMutex printMutex;
+    int lastPercent = -1;
+    QObject::connect(&worker, &DocumentAnalyzeWorker::progress, [&](int percent){
+        QMutexLocker locker(&printMutex);
+        if(percent == lastPercent) return;
+        lastPercent = percent;
+        std::cout << "[" << percent << "%]" << std::endl;
+    });
+    QObject::connect(&worker, &DocumentAnalyzeWorker::progressText, [&](QString text){
+        QMutexLocker locker(&printMutex);
+        std::cout << qPrintable(text) << std::endl;
+    });
+
+    QElapsedTimer timer;
+    timer.start();
+
+    if(parser.isSet(pairwiseOption))
+    {
+        std::cout << "All pairs of " << qPrintable(document.currentCategory) << " (" << catModels.size() << " shapes)" << std::endl;
+        worker.processAllPairWise();
+        if(worker.isFailed()){
+            std::cerr << qPrintable(worker.failureText) << std::endl;
+            return 1;
+        }
+        if(!worker.isCancelled()) document.sayPairwiseAnalysisDone();
+    }
+
+    if(parser.isSet(analyzeOption))
+    {
+        // Correspondence is computed against the first loaded model
+        QString source = parser.isSet(sourceOption) ? parser.value(sourceOption) : catModels.front();
+        if(!document.dataset.contains(source) || !document.loadModel(document.dataset[source]["graphFile"].toString())){
+            std::cerr << "Could not load source shape: " << qPrintable(source) << std::endl;
+            return 1;
+        }
+
+        std::cout << "Correspondence of " << qPrintable(document.currentCategory) << " to " << qPrintable(source) << std::endl;
+        worker.processShapeDataset();
+        if(!worker.isCancelled()) document.sayCategoryAnalysisDone();
+    }
+
+    std::cout << "Correspondence of " << qPrintable(document.currentCategory) << ": "
+              << document.datasetCorrMemory(document.currentCategory) / 1024 << " KB" << std::endl;
+    std::cout << qPrintable(document.cachedModels.statsText()) << std::endl;
+    std::cout << "Done in " << timer.elapsed() / 1000.0 << " s" << std::endl;
+
+    return 0;
+}
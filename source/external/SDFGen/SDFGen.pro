@@ -8,6 +8,14 @@ CONFIG(debug, debug|release) {CFG = debug} else {CFG = release}
 TARGET = SDFGen
 DESTDIR = $$PWD/lib/$$CFG
 
+# OpenMP
+win32{
+    QMAKE_CXXFLAGS *= /openmp
+}
+unix:!mac{
+    QMAKE_CXXFLAGS *= -fopenmp
+}
+
 SOURCES += makelevelset3.cpp
 
 HEADERS += \ 
@@ -17,5 +25,6 @@ HEADERS += \
     hashgrid.h \
     hashtable.h \
     makelevelset3.h \
+    sparsearray3.h \
     util.h \
     vec.h
@@ -56,21 +56,16 @@ static void check_neighbour(const std::vector<Vec3ui> &tri, const std::vector<Ve
 	}
 }
 
-static void sweep(const std::vector<Vec3ui> &tri, const std::vector<Vec3f> &x,
+// update one row along i of a sweep, in the sweep's direction
+static void sweep_row(const std::vector<Vec3ui> &tri, const std::vector<Vec3f> &x,
 	Array3f &phi, Array3i &closest_tri, const Vec3f &origin, float dx,
-	int di, int dj, int dk, float limit_distance)
+	int di, int dj, int dk, int j, int k, float limit_distance)
 {
 	int i0, i1;
 	if (di > 0){ i0 = 1; i1 = phi.ni; }
 	else{ i0 = phi.ni - 2; i1 = -1; }
-	int j0, j1;
-	if (dj > 0){ j0 = 1; j1 = phi.nj; }
-	else{ j0 = phi.nj - 2; j1 = -1; }
-	int k0, k1;
-	if (dk > 0){ k0 = 1; k1 = phi.nk; }
-	else{ k0 = phi.nk - 2; k1 = -1; }
-	
-	for (int k = k0; k != k1; k += dk) for (int j = j0; j != j1; j += dj) for (int i = i0; i != i1; i += di){
+
+	for (int i = i0; i != i1; i += di){
 		Vec3f gx(i*dx + origin[0], j*dx + origin[1], k*dx + origin[2]);
 
 		if (phi(i,j,k) > limit_distance) continue;
@@ -85,6 +80,47 @@ static void sweep(const std::vector<Vec3ui> &tri, const std::vector<Vec3f> &x,
 	}
 }
 
+static void sweep(const std::vector<Vec3ui> &tri, const std::vector<Vec3f> &x,
+	Array3f &phi, Array3i &closest_tri, const Vec3f &origin, float dx,
+	int di, int dj, int dk, float limit_distance)
+{
+	int j0, j1;
+	if (dj > 0){ j0 = 1; j1 = phi.nj; }
+	else{ j0 = phi.nj - 2; j1 = -1; }
+	int k0, k1;
+	if (dk > 0){ k0 = 1; k1 = phi.nk; }
+	else{ k0 = phi.nk - 2; k1 = -1; }
+	
+	for (int k = k0; k != k1; k += dk) for (int j = j0; j != j1; j += dj)
+		sweep_row(tri, x, phi, closest_tri, origin, dx, di, dj, dk, j, k, limit_distance);
+}
+
+// same result as sweep: a row reads only itself and rows one step back in j or k, so the
+// rows on one diagonal j+k of the sweep order are independent and updated in parallel
+static void sweep_wavefront(const std::vector<Vec3ui> &tri, const std::vector<Vec3f> &x,
+	Array3f &phi, Array3i &closest_tri, const Vec3f &origin, float dx,
+	int di, int dj, int dk, float limit_distance)
+{
+	int nj = phi.nj, nk = phi.nk;
+	if (nj < 2 || nk < 2) return;
+
+	for (int s = 2; s <= (nj - 1) + (nk - 1); ++s){
+		int js0 = std::max(1, s - (nk - 1)), js1 = std::min(nj - 1, s - 1);
+		#pragma omp parallel for schedule(static)
+		for (int js = js0; js <= js1; ++js){
+			int ks = s - js;
+			int j = (dj > 0) ? js : nj - 1 - js;
+			int k = (dk > 0) ? ks : nk - 1 - ks;
+			sweep_row(tri, x, phi, closest_tri, origin, dx, di, dj, dk, j, k, limit_distance);
+		}
+	}
+}
+
+// the eight sweep directions, run twice
+static const int sweep_directions[8][3] = {
+	{ +1, +1, +1 }, { -1, -1, -1 }, { +1, +1, -1 }, { -1, -1, +1 },
+	{ +1, -1, +1 }, { -1, +1, -1 }, { +1, -1, -1 }, { -1, +1, +1 } };
+
 // calculate twice signed area of triangle (0,0)-(x1,y1)-(x2,y2)
 // return an SOS-determined sign (-1, +1, or 0 only if it's a truly degenerate triangle)
 static int orientation(double x1, double y1, double x2, double y2, double &twice_signed_area)
@@ -121,7 +157,63 @@ static bool point_in_triangle_2d(double x0, double y0,
 	return true;
 }
 
-void make_level_set3(const std::vector<Vec3ui> &tri, const std::vector<Vec3f> &x,
+// exact distances near triangle t and its intersection counts, for grid slices k0..k1 only
+static void rasterize_triangle(const std::vector<Vec3ui> &tri, const std::vector<Vec3f> &x, unsigned int t,
+	const Vec3f &origin, float dx, int ni, int nj, int nk, int exact_band, int kmin, int kmax,
+	Array3f &phi, Array3i &closest_tri, Array3i &intersection_count)
+{
+	unsigned int p, q, r; assign(tri[t], p, q, r);
+	// coordinates in grid to high precision
+	double fip = ((double)x[p][0] - origin[0]) / dx, fjp = ((double)x[p][1] - origin[1]) / dx, fkp = ((double)x[p][2] - origin[2]) / dx;
+	double fiq = ((double)x[q][0] - origin[0]) / dx, fjq = ((double)x[q][1] - origin[1]) / dx, fkq = ((double)x[q][2] - origin[2]) / dx;
+	double fir = ((double)x[r][0] - origin[0]) / dx, fjr = ((double)x[r][1] - origin[1]) / dx, fkr = ((double)x[r][2] - origin[2]) / dx;
+	// do distances nearby
+	int i0 = clamp(int(min(fip, fiq, fir)) - exact_band, 0, ni - 1), i1 = clamp(int(max(fip, fiq, fir)) + exact_band + 1, 0, ni - 1);
+	int j0 = clamp(int(min(fjp, fjq, fjr)) - exact_band, 0, nj - 1), j1 = clamp(int(max(fjp, fjq, fjr)) + exact_band + 1, 0, nj - 1);
+	int k0 = clamp(int(min(fkp, fkq, fkr)) - exact_band, 0, nk - 1), k1 = clamp(int(max(fkp, fkq, fkr)) + exact_band + 1, 0, nk - 1);
+	k0 = std::max(k0, kmin); k1 = std::min(k1, kmax);
+	for (int k = k0; k <= k1; ++k) for (int j = j0; j <= j1; ++j) for (int i = i0; i <= i1; ++i){
+		Vec3f gx(i*dx + origin[0], j*dx + origin[1], k*dx + origin[2]);
+		float d = point_triangle_distance(gx, x[p], x[q], x[r]);
+		if (d < phi(i, j, k)){
+			phi(i, j, k) = d;
+			closest_tri(i, j, k) = t;
+		}
+	}
+	// and do intersection counts
+	j0 = clamp((int)std::ceil(min(fjp, fjq, fjr)), 0, nj - 1);
+	j1 = clamp((int)std::floor(max(fjp, fjq, fjr)), 0, nj - 1);
+	k0 = clamp((int)std::ceil(min(fkp, fkq, fkr)), 0, nk - 1);
+	k1 = clamp((int)std::floor(max(fkp, fkq, fkr)), 0, nk - 1);
+	k0 = std::max(k0, kmin); k1 = std::min(k1, kmax);
+	for (int k = k0; k <= k1; ++k) for (int j = j0; j <= j1; ++j){
+		double a, b, c;
+		if (point_in_triangle_2d(j, k, fjp, fkp, fjq, fkq, fjr, fkr, a, b, c)){
+			double fi = a*fip + b*fiq + c*fir; // intersection i coordinate
+			int i_interval = int(std::ceil(fi)); // intersection is in (i_interval-1,i_interval]
+			if (i_interval < 0) ++intersection_count(0, j, k); // we enlarge the first interval to include everything to the -x direction
+			else if (i_interval < ni) ++intersection_count(i_interval, j, k);
+			// we ignore intersections that are beyond the +x side of the grid
+		}
+	}
+}
+
+// figure out signs (inside/outside) from intersection counts
+static void apply_signs(Array3f &phi, const Array3i &intersection_count)
+{
+	#pragma omp parallel for schedule(static)
+	for (int k = 0; k < phi.nk; ++k) for (int j = 0; j < phi.nj; ++j){
+		int total_count = 0;
+		for (int i = 0; i < phi.ni; ++i){
+			total_count += intersection_count(i, j, k);
+			if (total_count % 2 == 1){ // if parity of intersections so far is odd,
+				phi(i, j, k) = -phi(i, j, k); // we are inside the mesh
+			}
+		}
+	}
+}
+
+void make_level_set3_serial(const std::vector<Vec3ui> &tri, const std::vector<Vec3f> &x,
 	const Vec3f &origin, float dx, int ni, int nj, int nk,
 	Array3f &phi, bool isSigned, float limit_distance, const int exact_band)
 {
@@ -130,62 +222,109 @@ void make_level_set3(const std::vector<Vec3ui> &tri, const std::vector<Vec3f> &x
 	Array3i closest_tri(ni, nj, nk, -1);
 	Array3i intersection_count(ni, nj, nk, 0); // intersection_count(i,j,k) is # of tri intersections in (i-1,i]x{j}x{k}
 	// we begin by initializing distances near the mesh, and figuring out intersection counts
-	Vec3f ijkmin, ijkmax;
+	for (unsigned int t = 0; t < tri.size(); ++t)
+		rasterize_triangle(tri, x, t, origin, dx, ni, nj, nk, exact_band, 0, nk - 1, phi, closest_tri, intersection_count);
+	// and now we fill in the rest of the distances with fast sweeping
+	for (unsigned int pass = 0; pass < 2; ++pass)
+		for (int d = 0; d < 8; ++d)
+			sweep(tri, x, phi, closest_tri, origin, dx, sweep_directions[d][0], sweep_directions[d][1], sweep_directions[d][2], limit_distance);
+
+	if (!isSigned) return;
+
+	apply_signs(phi, intersection_count);
+}
+
+void make_level_set3(const std::vector<Vec3ui> &tri, const std::vector<Vec3f> &x,
+	const Vec3f &origin, float dx, int ni, int nj, int nk,
+	Array3f &phi, bool isSigned, float limit_distance, const int exact_band)
+{
+	phi.resize(ni, nj, nk);
+	phi.assign(limit_distance); // upper bound on distance
+	Array3i closest_tri(ni, nj, nk, -1);
+	Array3i intersection_count(ni, nj, nk, 0); // intersection_count(i,j,k) is # of tri intersections in (i-1,i]x{j}x{k}
+	if (nk < 1) return;
+
+	// bin triangles into slabs of k slices by their exact band, in triangle order so that
+	// ties between equally close triangles resolve as in the serial version
+	int num_threads = 1;
+#ifdef _OPENMP
+	num_threads = omp_get_max_threads();
+#endif
+	int slab = std::max(1, (nk + 4 * num_threads - 1) / (4 * num_threads));
+	int num_slabs = (nk + slab - 1) / slab;
+	std::vector< std::vector<unsigned int> > slab_tris(num_slabs);
 	for (unsigned int t = 0; t < tri.size(); ++t){
 		unsigned int p, q, r; assign(tri[t], p, q, r);
-		// coordinates in grid to high precision
-		double fip = ((double)x[p][0] - origin[0]) / dx, fjp = ((double)x[p][1] - origin[1]) / dx, fkp = ((double)x[p][2] - origin[2]) / dx;
-		double fiq = ((double)x[q][0] - origin[0]) / dx, fjq = ((double)x[q][1] - origin[1]) / dx, fkq = ((double)x[q][2] - origin[2]) / dx;
-		double fir = ((double)x[r][0] - origin[0]) / dx, fjr = ((double)x[r][1] - origin[1]) / dx, fkr = ((double)x[r][2] - origin[2]) / dx;
-		// do distances nearby
-		int i0 = clamp(int(min(fip, fiq, fir)) - exact_band, 0, ni - 1), i1 = clamp(int(max(fip, fiq, fir)) + exact_band + 1, 0, ni - 1);
-		int j0 = clamp(int(min(fjp, fjq, fjr)) - exact_band, 0, nj - 1), j1 = clamp(int(max(fjp, fjq, fjr)) + exact_band + 1, 0, nj - 1);
+		double fkp = ((double)x[p][2] - origin[2]) / dx, fkq = ((double)x[q][2] - origin[2]) / dx, fkr = ((double)x[r][2] - origin[2]) / dx;
 		int k0 = clamp(int(min(fkp, fkq, fkr)) - exact_band, 0, nk - 1), k1 = clamp(int(max(fkp, fkq, fkr)) + exact_band + 1, 0, nk - 1);
-		for (int k = k0; k <= k1; ++k) for (int j = j0; j <= j1; ++j) for (int i = i0; i <= i1; ++i){
-			Vec3f gx(i*dx + origin[0], j*dx + origin[1], k*dx + origin[2]);
-			float d = point_triangle_distance(gx, x[p], x[q], x[r]);
-			if (d < phi(i, j, k)){
-				phi(i, j, k) = d;
-				closest_tri(i, j, k) = t;
-			}
-		}
-		// and do intersection counts
-		j0 = clamp((int)std::ceil(min(fjp, fjq, fjr)), 0, nj - 1);
-		j1 = clamp((int)std::floor(max(fjp, fjq, fjr)), 0, nj - 1);
-		k0 = clamp((int)std::ceil(min(fkp, fkq, fkr)), 0, nk - 1);
-		k1 = clamp((int)std::floor(max(fkp, fkq, fkr)), 0, nk - 1);
-		for (int k = k0; k <= k1; ++k) for (int j = j0; j <= j1; ++j){
-			double a, b, c;
-			if (point_in_triangle_2d(j, k, fjp, fkp, fjq, fkq, fjr, fkr, a, b, c)){
-				double fi = a*fip + b*fiq + c*fir; // intersection i coordinate
-				int i_interval = int(std::ceil(fi)); // intersection is in (i_interval-1,i_interval]
-				if (i_interval < 0) ++intersection_count(0, j, k); // we enlarge the first interval to include everything to the -x direction
-				else if (i_interval < ni) ++intersection_count(i_interval, j, k);
-				// we ignore intersections that are beyond the +x side of the grid
-			}
-		}
+		for (int b = k0 / slab; b <= k1 / slab; ++b) slab_tris[b].push_back(t);
 	}
-	// and now we fill in the rest of the distances with fast sweeping
-	for (unsigned int pass = 0; pass < 2; ++pass){
-		sweep(tri, x, phi, closest_tri, origin, dx, +1, +1, +1, limit_distance);
-		sweep(tri, x, phi, closest_tri, origin, dx, -1, -1, -1, limit_distance);
-		sweep(tri, x, phi, closest_tri, origin, dx, +1, +1, -1, limit_distance);
-		sweep(tri, x, phi, closest_tri, origin, dx, -1, -1, +1, limit_distance);
-		sweep(tri, x, phi, closest_tri, origin, dx, +1, -1, +1, limit_distance);
-		sweep(tri, x, phi, closest_tri, origin, dx, -1, +1, -1, limit_distance);
-		sweep(tri, x, phi, closest_tri, origin, dx, +1, -1, -1, limit_distance);
-		sweep(tri, x, phi, closest_tri, origin, dx, -1, +1, +1, limit_distance);
+
+	// slabs write disjoint slices
+	#pragma omp parallel for schedule(dynamic)
+	for (int b = 0; b < num_slabs; ++b){
+		int kmin = b * slab, kmax = std::min(nk, (b + 1) * slab) - 1;
+		for (unsigned int t : slab_tris[b])
+			rasterize_triangle(tri, x, t, origin, dx, ni, nj, nk, exact_band, kmin, kmax, phi, closest_tri, intersection_count);
 	}
 
+	for (unsigned int pass = 0; pass < 2; ++pass)
+		for (int d = 0; d < 8; ++d)
+			sweep_wavefront(tri, x, phi, closest_tri, origin, dx, sweep_directions[d][0], sweep_directions[d][1], sweep_directions[d][2], limit_distance);
+
 	if (!isSigned) return;
 
-	// then figure out signs (inside/outside) from intersection counts
-	for (int k = 0; k < nk; ++k) for (int j = 0; j < nj; ++j){
-		int total_count = 0;
-		for (int i = 0; i < ni; ++i){
-			total_count += intersection_count(i, j, k);
-			if (total_count % 2 == 1){ // if parity of intersections so far is odd,
-				phi(i, j, k) = -phi(i, j, k); // we are inside the mesh
+	apply_signs(phi, intersection_count);
+}
+
+void make_level_set3_narrow_band(const std::vector<Vec3ui> &tri, const std::vector<Vec3f> &x,
+	const Vec3f &origin, float dx, int ni, int nj, int nk,
+	SparseArray3f &phi, float band_distance)
+{
+	phi.resize(ni, nj, nk, band_distance);
+	if (ni < 1 || nj < 1 || nk < 1) return;
+
+	// cells around a triangle that can be closer than the band, one more so that marched
+	// cells next to an allocated brick are allocated too
+	int band = int(std::ceil(band_distance / dx)) + 1;
+	const int bits = SparseArray3f::brick_bits, size = SparseArray3f::brick_size;
+
+	// allocate the bricks near each triangle and bin triangles by brick, in triangle order
+	std::vector<int> tri_box(tri.size() * 6);
+	std::vector< std::vector<unsigned int> > brick_tris;
+	for (unsigned int t = 0; t < tri.size(); ++t){
+		unsigned int p, q, r; assign(tri[t], p, q, r);
+		int * box = &tri_box[t * 6];
+		for (int c = 0; c < 3; ++c){
+			double fp = ((double)x[p][c] - origin[c]) / dx, fq = ((double)x[q][c] - origin[c]) / dx, fr = ((double)x[r][c] - origin[c]) / dx;
+			int n = (c == 0) ? ni : ((c == 1) ? nj : nk);
+			box[c] = clamp(int(min(fp, fq, fr)) - band, 0, n - 1);
+			box[c + 3] = clamp(int(max(fp, fq, fr)) + band + 1, 0, n - 1);
+		}
+		for (int bk = box[2] >> bits; bk <= box[5] >> bits; ++bk)
+			for (int bj = box[1] >> bits; bj <= box[4] >> bits; ++bj)
+				for (int bi = box[0] >> bits; bi <= box[3] >> bits; ++bi){
+					int b = phi.allocate_brick(bi, bj, bk);
+					if (b >= int(brick_tris.size())) brick_tris.resize(b + 1);
+					brick_tris[b].push_back(t);
+				}
+	}
+
+	// bricks write disjoint cells
+	#pragma omp parallel for schedule(dynamic)
+	for (int b = 0; b < phi.num_bricks(); ++b){
+		int bi0 = phi.brick_coords[b * 3 + 0] * size, bj0 = phi.brick_coords[b * 3 + 1] * size, bk0 = phi.brick_coords[b * 3 + 2] * size;
+		for (unsigned int t : brick_tris[b]){
+			unsigned int p, q, r; assign(tri[t], p, q, r);
+			const int * box = &tri_box[t * 6];
+			int i0 = std::max(box[0], bi0), i1 = std::min(box[3], std::min(bi0 + size, ni) - 1);
+			int j0 = std::max(box[1], bj0), j1 = std::min(box[4], std::min(bj0 + size, nj) - 1);
+			int k0 = std::max(box[2], bk0), k1 = std::min(box[5], std::min(bk0 + size, nk) - 1);
+			for (int k = k0; k <= k1; ++k) for (int j = j0; j <= j1; ++j) for (int i = i0; i <= i1; ++i){
+				Vec3f gx(i*dx + origin[0], j*dx + origin[1], k*dx + origin[2]);
+				float d = point_triangle_distance(gx, x[p], x[q], x[r]);
+				float & value = phi.at(b, i, j, k);
+				if (d < value) value = d;
 			}
 		}
 	}
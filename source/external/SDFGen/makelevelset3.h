@@ -3,6 +3,11 @@
 
 #include "array3.h"
 #include "vec.h"
+#include "sparsearray3.h"
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 namespace SDFGen{
 // tri is a list of triangles in the mesh, and x is the positions of the vertices
@@ -10,10 +15,22 @@ namespace SDFGen{
 // needed for accurate signs. Distances for all grid cells within exact_band cells of
 // a triangle should be exact; further away a distance is calculated but it might not
 // be to the closest triangle - just one nearby.
+// Runs on all OpenMP threads, and gives the same distances as make_level_set3_serial.
 void make_level_set3(const std::vector<Vec3ui> &tri, const std::vector<Vec3f> &x,
                      const Vec3f &origin, float dx, int nx, int ny, int nz,
 					 Array3f &phi, bool isSigned = true, float limit_distance = std::numeric_limits<float>::max(), const int exact_band = 1);
 
+// Single threaded reference of make_level_set3
+void make_level_set3_serial(const std::vector<Vec3ui> &tri, const std::vector<Vec3f> &x,
+                     const Vec3f &origin, float dx, int nx, int ny, int nz,
+					 Array3f &phi, bool isSigned = true, float limit_distance = std::numeric_limits<float>::max(), const int exact_band = 1);
+
+// Unsigned distances up to band_distance, computed exactly and stored only in bricks that
+// are within band_distance of a triangle. Other cells read band_distance.
+void make_level_set3_narrow_band(const std::vector<Vec3ui> &tri, const std::vector<Vec3f> &x,
+                     const Vec3f &origin, float dx, int nx, int ny, int nz,
+					 SparseArray3f &phi, float band_distance);
+
 #ifdef SDFGEN_HEADER_ONLY
 #include "makelevelset3.cpp"
 #endif
@@ -5,15 +5,20 @@
 #include <vector>
 #include <utility>
 #include <cmath>
+#include <algorithm>
 #include <omp.h>
 
+#include "array3.h"
+#include "sparsearray3.h"
+
 #define MC_VOLUME_PADDING 10
 
-typedef std::vector<std::vector<std::vector<float> > > ScalarVolume;
+// Flat volume with x varying fastest, the layout make_level_set3 writes, so its output
+// is marched in place. Values are read as volume(x, y, z).
+typedef Array3f ScalarVolume;
 inline ScalarVolume initScalarVolume( size_t gridsize, float value = 0 ){
 	gridsize += (MC_VOLUME_PADDING * 2); // add padding
-	return std::vector<std::vector<std::vector<float> > >( gridsize, 
-		std::vector<std::vector<float> >(gridsize, std::vector<float>( gridsize, value )) );
+	return ScalarVolume( int(gridsize), int(gridsize), int(gridsize), value );
 }
 inline ScalarVolume initScalarVolume( size_t x, size_t y, size_t z, float value = 0, bool addPadding = false ){
         if(addPadding)
@@ -23,17 +28,15 @@ inline ScalarVolume initScalarVolume( size_t x, size_t y, size_t z, float value
             z += (MC_VOLUME_PADDING * 2); // add padding
         }
 
-        return std::vector<std::vector<std::vector<float> > >( z,
-                std::vector<std::vector<float> >(y, std::vector<float>( x, value )) );
+        return ScalarVolume( int(x), int(y), int(z), value );
 }
 inline ScalarVolume addPaddingToVolume( const ScalarVolume & fromVolume, float value = 0 ){
-	size_t gridsize = fromVolume.size();
-	ScalarVolume volume = initScalarVolume( gridsize, value );
+	ScalarVolume volume = initScalarVolume( fromVolume.ni, fromVolume.nj, fromVolume.nk, value, true );
 	#pragma omp parallel for
-	for(int x = 0; x < gridsize; x++)
-		for(int y = 0; y < gridsize; y++)
-			for(int z = 0; z < gridsize; z++)
-				volume[x+MC_VOLUME_PADDING][y+MC_VOLUME_PADDING][z+MC_VOLUME_PADDING] = fromVolume[x][y][z];
+	for(int z = 0; z < fromVolume.nk; z++)
+		for(int y = 0; y < fromVolume.nj; y++)
+			for(int x = 0; x < fromVolume.ni; x++)
+				volume(x+MC_VOLUME_PADDING, y+MC_VOLUME_PADDING, z+MC_VOLUME_PADDING) = fromVolume(x, y, z);
 	return volume;
 }
 
@@ -336,99 +339,328 @@ struct Point3f {
 	float z;
 };
 
-int polygonize( std::vector< std::pair<Point3f, double> >& cell, const double isovalue, std::vector<Point3f>& pnts, const double iso_eps = 1.0e-6) {
+// Corners of one cell, corner c at offset (c&1, (c>>1)&1, (c>>2)&1) from the first
+struct MarchCell {
+	Point3f p[8];
+	double v[8];
+};
+
+// Writes the triangles of a cell to pnts, at most 5, and returns their number.
+// Values near the isovalue are moved off it.
+inline int polygonize( MarchCell& cell, const double isovalue, Point3f pnts[15], const double iso_eps = 1.0e-6 ) {
 	unsigned char tableid = 0x00;
-    for( int i = 0 ; i < 8 ; ++i ) {
-		if ( std::fabs( cell[i].second - isovalue ) < iso_eps ) cell[i].second = isovalue + iso_eps;
-		if ( isovalue <=  cell[i].second ) tableid += ( 0x01 <<i );
+	for( int i = 0 ; i < 8 ; ++i ) {
+		if ( std::fabs( cell.v[i] - isovalue ) < iso_eps ) cell.v[i] = isovalue + iso_eps;
+		if ( isovalue <=  cell.v[i] ) tableid += ( 0x01 <<i );
 	}
 	if ( tableid == 0x00 || tableid == 0xFF ) return 0;
 	Point3f ep[12];
 	for( int i = 0 ; i < 12 ; i++ ) {
 		const int& id0 = mc_edtable[ 2 * i + 0];
 		const int& id1 = mc_edtable[ 2 * i + 1];
-		
-		const double& v0 = cell[id0].second;
-		const double& v1 = cell[id1].second;
+
+		const double& v0 = cell.v[id0];
+		const double& v1 = cell.v[id1];
 		if( std::fabs( v0 - v1 ) <  1.0e-10 ) continue;
-		
+
 		const double t = ( isovalue - v0 ) * 1.0 / ( v1 - v0 );
-		const Point3f& p0 = cell[id0].first;
-		const Point3f& p1 = cell[id1].first;
-		
+		const Point3f& p0 = cell.p[id0];
+		const Point3f& p1 = cell.p[id1];
+
 		ep[i].x = static_cast<float>(( 1.0 - t ) * p0.x + t * p1.x);
 		ep[i].y = static_cast<float>(( 1.0 - t ) * p0.y + t * p1.y);
 		ep[i].z = static_cast<float>(( 1.0 - t ) * p0.z + t * p1.z);
 	}
-	
-	int numTriangles = 0;
-	for( int i =  mc_colidx[tableid] ; i < mc_colidx[tableid+1] ; i += 3 ) {
-		++numTriangles;
-		pnts.push_back( ep[ mc_idxtable[i  ] ] );
-		pnts.push_back( ep[ mc_idxtable[i+1] ] );
-		pnts.push_back( ep[ mc_idxtable[i+2] ] );
-	}
+
+	int numPoints = 0;
+	for( int i =  mc_colidx[tableid] ; i < mc_colidx[tableid+1] ; ++i )
+		pnts[numPoints++] = ep[ mc_idxtable[i] ];
+	return numPoints / 3;
+}
+
+int polygonize( std::vector< std::pair<Point3f, double> >& cell, const double isovalue, std::vector<Point3f>& pnts, const double iso_eps = 1.0e-6) {
+	MarchCell c;
+	for( int i = 0 ; i < 8 ; ++i ) { c.p[i] = cell[i].first; c.v[i] = cell[i].second; }
+
+	Point3f cellPnts[15];
+	int numTriangles = polygonize( c, isovalue, cellPnts, iso_eps );
+	for( int i = 0 ; i < 8 ; ++i ) cell[i].second = c.v[i];
+	pnts.insert( pnts.end(), cellPnts, cellPnts + numTriangles * 3 );
 	return numTriangles;
 }
 
-inline std::vector< std::vector<Point3f> > march( const ScalarVolume & volume, double isovalue = 0.0, bool isPadded = false )
+// Triangles as three points each, reversed from polygonize's order
+typedef std::vector<Point3f> TriangleSoup;
+
+// Appends the triangles of the cell with first corner (x,y,z) to the arena. Corners are
+// read before positions are made, so cells away from the surface cost eight reads.
+template<class Volume>
+inline void march_cell( const Volume & volume, int x, int y, int z, double isovalue, TriangleSoup & arena )
 {
-        int sz = (int)volume.size();
-        int sy = (int)volume.front().size();
-        int sx = (int)volume.front().front().size();
+	MarchCell cell;
+	bool below = false, above = false;
+	for( int c = 0 ; c < 8 ; ++c ) {
+		cell.v[c] = volume( x + ( c & 1 ), y + ( ( c >> 1 ) & 1 ), z + ( ( c >> 2 ) & 1 ) );
+		( cell.v[c] < isovalue ? below : above ) = true;
+	}
 
-	std::vector< std::vector<Point3f> > allTriangles;
+	// Cells entirely above stay so, cells entirely below cross only where polygonize
+	// moves a value near the isovalue above it
+	if( !below ) return;
+	if( !above ) {
+		bool nearIso = false;
+		for( int c = 0 ; c < 8 ; ++c ) nearIso |= std::fabs( cell.v[c] - isovalue ) < 1.0e-6;
+		if( !nearIso ) return;
+	}
 
-	std::vector< std::vector< std::vector<Point3f> > > trianglesThread( omp_get_max_threads() );
+	for( int c = 0 ; c < 8 ; ++c ) {
+		cell.p[c].x = float( x + ( c & 1 ) );
+		cell.p[c].y = float( y + ( ( c >> 1 ) & 1 ) );
+		cell.p[c].z = float( z + ( ( c >> 2 ) & 1 ) );
+	}
+
+	Point3f pnts[15];
+	int numTriangles = polygonize( cell, isovalue, pnts );
+	for( int i = 0 ; i < numTriangles ; ++i ) {
+		arena.push_back( pnts[i * 3 + 2] );
+		arena.push_back( pnts[i * 3 + 1] );
+		arena.push_back( pnts[i * 3 + 0] );
+	}
+}
+
+// Arenas copied one after another into a single soup, in parallel
+inline TriangleSoup concatenate_arenas( const std::vector<TriangleSoup> & arenas )
+{
+	std::vector<size_t> offsets( arenas.size() + 1, 0 );
+	for( size_t t = 0 ; t < arenas.size() ; ++t ) offsets[t + 1] = offsets[t] + arenas[t].size();
 
+	TriangleSoup soup( offsets.back() );
 	#pragma omp parallel for
-	for( int z = 0 ; z < sz - 1 ; ++z ) {
+	for( int t = 0 ; t < int( arenas.size() ) ; ++t )
+		std::copy( arenas[t].begin(), arenas[t].end(), soup.begin() + offsets[t] );
+	return soup;
+}
+
+inline TriangleSoup march( const ScalarVolume & volume, double isovalue = 0.0, bool isPadded = false )
+{
+	int sz = volume.nk;
+	int sy = volume.nj;
+	int sx = volume.ni;
+	if( sx < 2 || sy < 2 || sz < 2 ) return TriangleSoup();
+
+	// Room for a surface about the size of the grid's faces
+	std::vector<TriangleSoup> arenas( omp_get_max_threads() );
+	size_t expected = size_t( 2 * 3 ) * ( size_t( sx ) * sy + size_t( sy ) * sz + size_t( sz ) * sx );
+
+	#pragma omp parallel
+	{
+		TriangleSoup & arena = arenas[ omp_get_thread_num() ];
+		arena.reserve( expected / arenas.size() );
+
+		#pragma omp for schedule(static)
+		for( int z = 0 ; z < sz - 1 ; ++z )
+			for( int y = 0 ; y < sy - 1 ; ++y )
+				for( int x = 0 ; x < sx - 1 ; ++x )
+					march_cell( volume, x, y, z, isovalue, arena );
+
+		// Remove padding
+		if( isPadded ) {
+			for( auto & p : arena ) {
+				p.x -= MC_VOLUME_PADDING;
+				p.y -= MC_VOLUME_PADDING;
+				p.z -= MC_VOLUME_PADDING;
+			}
+		}
+	}
+
+	return concatenate_arenas( arenas );
+}
+
+// Marches only the cells whose first corner lies in an allocated brick, the others read the
+// background everywhere. Cells reaching into a neighbouring brick read its values.
+inline TriangleSoup march( const SparseArray3f & volume, double isovalue = 0.0 )
+{
+	const int size = SparseArray3f::brick_size;
+
+	// Room for a surface crossing each brick once
+	std::vector<TriangleSoup> arenas( omp_get_max_threads() );
+	size_t expected = size_t( 2 * 3 ) * size * size * volume.num_bricks();
+
+	#pragma omp parallel
+	{
+		TriangleSoup & arena = arenas[ omp_get_thread_num() ];
+		arena.reserve( expected / arenas.size() );
+
+		#pragma omp for schedule(dynamic)
+		for( int b = 0 ; b < volume.num_bricks() ; ++b ) {
+			int x0 = volume.brick_coords[b * 3 + 0] * size;
+			int y0 = volume.brick_coords[b * 3 + 1] * size;
+			int z0 = volume.brick_coords[b * 3 + 2] * size;
+			int x1 = std::min( x0 + size, volume.ni - 1 );
+			int y1 = std::min( y0 + size, volume.nj - 1 );
+			int z1 = std::min( z0 + size, volume.nk - 1 );
+
+			for( int z = z0 ; z < z1 ; ++z )
+				for( int y = y0 ; y < y1 ; ++y )
+					for( int x = x0 ; x < x1 ; ++x )
+						march_cell( volume, x, y, z, isovalue, arena );
+		}
+	}
+
+	return concatenate_arenas( arenas );
+}
+
+// Surface with shared vertices, one per crossed grid edge, in grid coordinates
+struct MarchedMesh {
+	std::vector<Point3f> vertices;
+	std::vector<int> triangles;     // three vertex indices per triangle
+};
+
+// Vertex ids of the x and y edges of one z plane, or of the z edges of one slab
+struct MarchedPlane {
+	std::vector<int> ids[2];
+	void reset( int n ) { ids[0].assign( n, -1 ); ids[1].assign( n, -1 ); }
+};
+
+// Marches slabs z0..z1-1 in order. Edge vertices are cached for the bottom and top planes
+// of the current slab and its z edges, so every crossed edge gets one vertex. The x and y
+// edge ids of planes z0 and z1 are returned for joining with the neighbouring ranges.
+template<class Volume, class CellFilter>
+inline MarchedMesh march_indexed_slabs( const Volume & volume, int sx, int sy, int z0, int z1,
+	double isovalue, CellFilter isCellMarched, MarchedPlane & first, MarchedPlane & last,
+	const double iso_eps = 1.0e-6 )
+{
+	MarchedMesh mesh;
+
+	// Values near the isovalue are moved off it, as in polygonize
+	auto valueAt = [&]( int x, int y, int z ) -> double {
+		double v = volume( x, y, z );
+		return ( std::fabs( v - isovalue ) < iso_eps ) ? isovalue + iso_eps : v;
+	};
+
+	MarchedPlane bottom, top, zEdges;
+	bottom.reset( sx * sy ); top.reset( sx * sy ); zEdges.ids[0].assign( sx * sy, -1 );
+
+	// Vertex on the edge from grid point (x,y,z) along axis, interpolated from its lower end
+	auto edgeVertex = [&]( int x, int y, int z, int axis, int slabZ ) -> int {
+		int & id = ( axis == 2 ) ? zEdges.ids[0][x + sx * y] : ( z == slabZ ? bottom : top ).ids[axis][x + sx * y];
+		if ( id >= 0 ) return id;
+
+		int x1 = x + ( axis == 0 ), y1 = y + ( axis == 1 ), z1 = z + ( axis == 2 );
+		double v0 = valueAt( x, y, z ), v1 = valueAt( x1, y1, z1 );
+		double t = ( isovalue - v0 ) / ( v1 - v0 );
+
+		Point3f p;
+		p.x = static_cast<float>( ( 1.0 - t ) * x + t * x1 );
+		p.y = static_cast<float>( ( 1.0 - t ) * y + t * y1 );
+		p.z = static_cast<float>( ( 1.0 - t ) * z + t * z1 );
+
+		id = int( mesh.vertices.size() );
+		mesh.vertices.push_back( p );
+		return id;
+	};
+
+	for( int z = z0 ; z < z1 ; ++z ) {
 		for( int y = 0 ; y < sy - 1 ; ++y ) {
 			for( int x = 0 ; x < sx - 1 ; ++x ) {
-				std::vector<std::pair<Point3f, double> > cell;
-				for( int dz = 0 ; dz < 2; ++dz ) {
-					for( int dy = 0 ; dy < 2 ; ++dy ) {
-						for( int dx = 0 ; dx < 2 ; ++dx ) {
-							Point3f p;
-							p.x  = x + dx;
-							p.y  = y + dy;
-							p.z  = z + dz;
-							float value = volume[p.z][p.y][p.x];
-							cell.push_back ( std::make_pair( p, value) );
-						}
-					}
-				}				
-
-				std::vector<Point3f> pnts;
-				polygonize(cell, isovalue, pnts ) ;
-
-				// Remove padding
-                                if(isPadded)
-                                {
-                                    for(size_t i = 0; i < pnts.size(); i++){
-                                            pnts[i].x -= MC_VOLUME_PADDING;
-                                            pnts[i].y -= MC_VOLUME_PADDING;
-                                            pnts[i].z -= MC_VOLUME_PADDING;
-                                    }
-                                }
-
-				for(size_t i = 0; i < pnts.size() / 3; i++)
-				{
-					std::vector<Point3f> triangle;
-					triangle.push_back( pnts[i * 3 + 2] );
-					triangle.push_back( pnts[i * 3 + 1] );
-					triangle.push_back( pnts[i * 3 + 0] );
-
-					trianglesThread[ omp_get_thread_num() ].push_back( triangle );
+				if( !isCellMarched( x, y, z ) ) continue;
+
+				// Corner c is at (x,y,z) + (c&1, (c>>1)&1, (c>>2)&1)
+				unsigned char tableid = 0x00;
+				for( int c = 0 ; c < 8 ; ++c ) {
+					if ( isovalue <= valueAt( x + ( c & 1 ), y + ( ( c >> 1 ) & 1 ), z + ( ( c >> 2 ) & 1 ) ) )
+						tableid += ( 0x01 << c );
+				}
+				if ( tableid == 0x00 || tableid == 0xFF ) continue;
+
+				int ep[12];
+				for( int e = 0 ; e < 12 ; ++e ) ep[e] = -1;
+
+				for( int i = mc_colidx[tableid] ; i < mc_colidx[tableid+1] ; ++i ) {
+					int e = mc_idxtable[i];
+					if( ep[e] >= 0 ) continue;
+					int c = std::min( mc_edtable[2 * e + 0], mc_edtable[2 * e + 1] );
+					int axis = ( ( mc_edtable[2 * e + 0] ^ mc_edtable[2 * e + 1] ) == 1 ) ? 0 : ( ( ( mc_edtable[2 * e + 0] ^ mc_edtable[2 * e + 1] ) == 2 ) ? 1 : 2 );
+					ep[e] = edgeVertex( x + ( c & 1 ), y + ( ( c >> 1 ) & 1 ), z + ( ( c >> 2 ) & 1 ), axis, z );
+				}
+
+				// Same winding as march
+				for( int i = mc_colidx[tableid] ; i < mc_colidx[tableid+1] ; i += 3 ) {
+					mesh.triangles.push_back( ep[ mc_idxtable[i+2] ] );
+					mesh.triangles.push_back( ep[ mc_idxtable[i+1] ] );
+					mesh.triangles.push_back( ep[ mc_idxtable[i  ] ] );
 				}
 			}
 		}
+
+		if( z == z0 ) first = bottom;
+		if( z == z1 - 1 ) last = top;
+
+		// The top plane is the next slab's bottom
+		std::swap( bottom, top );
+		top.reset( sx * sy );
+		zEdges.ids[0].assign( sx * sy, -1 );
 	}
 
-	// Combine
-	for(auto tris : trianglesThread)
-		for(auto t : tris)
-			allTriangles.push_back(t);
+	return mesh;
+}
 
-	return allTriangles;
+// Slab ranges marched in parallel, then joined: vertices of a range's first plane that
+// the previous range also made are replaced by the previous range's vertices.
+template<class Volume, class CellFilter>
+inline MarchedMesh march_indexed_volume( const Volume & volume, int sx, int sy, int sz, double isovalue, CellFilter isCellMarched )
+{
+	MarchedMesh result;
+	if( sx < 2 || sy < 2 || sz < 2 ) return result;
+
+	int numRanges = std::max( 1, std::min( omp_get_max_threads(), sz - 1 ) );
+	std::vector<MarchedMesh> meshes( numRanges );
+	std::vector<MarchedPlane> firsts( numRanges ), lasts( numRanges );
+
+	#pragma omp parallel for schedule(static)
+	for( int r = 0 ; r < numRanges ; ++r ) {
+		int z0 = ( sz - 1 ) * r / numRanges, z1 = ( sz - 1 ) * ( r + 1 ) / numRanges;
+		if( z0 < z1 ) meshes[r] = march_indexed_slabs( volume, sx, sy, z0, z1, isovalue, isCellMarched, firsts[r], lasts[r] );
+	}
+
+	std::vector<int> previousIds;
+	for( int r = 0 ; r < numRanges ; ++r ) {
+		auto & mesh = meshes[r];
+		std::vector<int> ids( mesh.vertices.size(), -1 );
+
+		// Shared plane with the previous range
+		if( r > 0 && !firsts[r].ids[0].empty() && !lasts[r-1].ids[0].empty() ) {
+			for( int axis = 0 ; axis < 2 ; ++axis ) {
+				for( size_t i = 0 ; i < firsts[r].ids[axis].size() ; ++i ) {
+					int mine = firsts[r].ids[axis][i], theirs = lasts[r-1].ids[axis][i];
+					if( mine >= 0 && theirs >= 0 ) ids[mine] = previousIds[theirs];
+				}
+			}
+		}
+
+		for( size_t v = 0 ; v < mesh.vertices.size() ; ++v ) {
+			if( ids[v] >= 0 ) continue;
+			ids[v] = int( result.vertices.size() );
+			result.vertices.push_back( mesh.vertices[v] );
+		}
+
+		for( int v : mesh.triangles ) result.triangles.push_back( ids[v] );
+
+		previousIds.swap( ids );
+	}
+
+	return result;
+}
+
+inline MarchedMesh march_indexed( const ScalarVolume & volume, double isovalue = 0.0 )
+{
+	return march_indexed_volume( volume, volume.ni, volume.nj, volume.nk, isovalue,
+		[]( int, int, int ) { return true; } );
+}
+
+// Cells whose first corner lies in an allocated brick, as in march
+inline MarchedMesh march_indexed( const SparseArray3f & volume, double isovalue = 0.0 )
+{
+	return march_indexed_volume( volume, volume.ni, volume.nj, volume.nk, isovalue,
+		[&]( int x, int y, int z ) { return volume.brick_of( x, y, z ) >= 0; } );
 }
@@ -0,0 +1,87 @@
+#ifndef SPARSEARRAY3_H
+#define SPARSEARRAY3_H
+
+#include <cassert>
+#include <vector>
+
+// An ni x nj x nk grid stored in bricks of 8x8x8 cells. Only allocated bricks hold values,
+// cells of other bricks read as the background value. Suited to narrow band level sets,
+// where memory then grows with the surface area rather than the volume of the grid.
+template<class T>
+struct SparseArray3
+{
+   static const int brick_bits = 3;
+   static const int brick_size = 1 << brick_bits;
+   static const int brick_cells = brick_size * brick_size * brick_size;
+
+   int ni, nj, nk;      // cells
+   int bi, bj, bk;      // bricks
+   T background;
+
+   std::vector<int> brick_index;   // allocated brick of each brick position, -1 if none
+   std::vector<int> brick_coords;  // brick position of each allocated brick, as i,j,k triples
+   std::vector<T> a;               // values of allocated bricks, brick after brick
+
+   SparseArray3(void)
+      : ni(0), nj(0), nk(0), bi(0), bj(0), bk(0), background()
+   {}
+
+   // removes all bricks
+   void resize(int ni_, int nj_, int nk_, const T& background_)
+   {
+      assert(ni_>=0 && nj_>=0 && nk_>=0);
+      ni=ni_; nj=nj_; nk=nk_;
+      bi=(ni+brick_size-1)>>brick_bits;
+      bj=(nj+brick_size-1)>>brick_bits;
+      bk=(nk+brick_size-1)>>brick_bits;
+      background=background_;
+      brick_index.assign(bi*bj*bk, -1);
+      brick_coords.clear();
+      a.clear();
+   }
+
+   int num_bricks(void) const
+   { return int(brick_coords.size()/3); }
+
+   // allocated brick at brick position (i,j,k), filled with the background when new
+   int allocate_brick(int i, int j, int k)
+   {
+      assert(i>=0 && i<bi && j>=0 && j<bj && k>=0 && k<bk);
+      int& b=brick_index[i+bi*(j+bj*k)];
+      if(b<0){
+         b=num_bricks();
+         brick_coords.push_back(i); brick_coords.push_back(j); brick_coords.push_back(k);
+         a.resize(a.size()+brick_cells, background);
+      }
+      return b;
+   }
+
+   // allocated brick holding cell (i,j,k), -1 if none
+   int brick_of(int i, int j, int k) const
+   {
+      assert(i>=0 && i<ni && j>=0 && j<nj && k>=0 && k<nk);
+      return brick_index[(i>>brick_bits)+bi*((j>>brick_bits)+bj*(k>>brick_bits))];
+   }
+
+   // offset of cell (i,j,k) inside its brick
+   static int cell_in_brick(int i, int j, int k)
+   { return (i&(brick_size-1))+brick_size*((j&(brick_size-1))+brick_size*(k&(brick_size-1))); }
+
+   const T& operator()(int i, int j, int k) const
+   {
+      int b=brick_of(i,j,k);
+      if(b<0) return background;
+      return a[b*brick_cells+cell_in_brick(i,j,k)];
+   }
+
+   // cell of an allocated brick
+   T& at(int b, int i, int j, int k)
+   { return a[b*brick_cells+cell_in_brick(i,j,k)]; }
+
+   size_t memory(void) const
+   { return brick_index.size()*sizeof(int)+brick_coords.size()*sizeof(int)+a.size()*sizeof(T); }
+};
+
+typedef SparseArray3<float> SparseArray3f;
+
+#endif